@@ -0,0 +1,327 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#ifdef FIXED_SET_BENCH_ABSL
+#include <absl/container/flat_hash_set.h>
+#endif
+
+#include "fixed_set.h"
+#include "compact_fixed_set.h"
+
+// Build and lookup benchmarks of FixedSet against the usual alternatives, over key counts
+// from 1K up to --max_keys (10M by default, pass --max_keys=100000000 for the 100M runs)
+// and several key distributions. Reported counters:
+//   items_per_second  keys inserted per second for Build, lookups per second otherwise;
+//   bytes_per_key     memory held by the structure divided by the number of keys.
+
+namespace {
+
+size_t max_keys = 10'000'000;
+
+// Random keys are drawn from [-kSpan / 2, kSpan / 2), which is narrower than the prime of
+// LinearHashFunction: keys a multiple of the prime apart always collide, and at these sizes
+// a full int range would contain such pairs.
+constexpr int kSpan = 1'000'000'000;
+
+enum Distribution {
+    kSequential,
+    kUniform,
+    kClustered,
+    kAdversarial,
+};
+
+const char* const kDistributionNames[] = {"sequential", "uniform", "clustered", "adversarial"};
+
+// Returns unique keys in random order, every distribution is generated once per size.
+const std::vector<int>& GetKeys(Distribution distribution, size_t count) {
+    static std::map<std::pair<int, size_t>, std::vector<int>> cache;
+    auto [it, inserted] = cache.try_emplace({distribution, count});
+    std::vector<int>& keys = it->second;
+    if (!inserted) {
+        return keys;
+    }
+    Xoshiro256 generator(count * 4 + distribution);
+    keys.reserve(count);
+    switch (distribution) {
+        case kSequential:
+            // As in RepeatInitialize.
+            for (size_t i = 0; i < count; ++i) {
+                keys.push_back(i);
+            }
+            break;
+        case kUniform:
+            while (keys.size() < count) {
+                while (keys.size() < count) {
+                    keys.push_back(static_cast<int>(generator.Uniform(kSpan)) - kSpan / 2);
+                }
+                std::sort(keys.begin(), keys.end());
+                keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+            }
+            break;
+        case kClustered: {
+            // Runs of 64 keys three apart, one at a random place of each of count / 64 equal
+            // ranges that cover the span.
+            const int64_t run_length = 64 * 3;
+            int64_t range = std::max<int64_t>(2 * run_length, kSpan / (count / 64 + 1));
+            for (int64_t i = 0; keys.size() < count; ++i) {
+                int64_t start = -kSpan / 2 + i * range + generator.Uniform(range - run_length);
+                for (int64_t j = 0; j < run_length && keys.size() < count; j += 3) {
+                    keys.push_back(start + j);
+                }
+            }
+            break;
+        }
+        case kAdversarial: {
+            // The progression Magic() probes with its pair of keys: starting at -1e9 with the
+            // widest stride that fits into int.
+            int64_t stride = std::max<int64_t>(1, 3'000'000'000LL / count);
+            for (size_t i = 0; i < count; ++i) {
+                keys.push_back(-1'000'000'000 + static_cast<int64_t>(i) * stride);
+            }
+            break;
+        }
+    }
+    std::shuffle(keys.begin(), keys.end(), generator);
+    return keys;
+}
+
+// kQueryCount lookups: keys of the set for hits, keys outside of it for misses.
+constexpr size_t kQueryCount = 1 << 20;
+
+std::vector<int> GetQueries(const std::vector<int>& keys, bool hits) {
+    Xoshiro256 generator(keys.size() * 2 + hits);
+    std::vector<int> queries;
+    queries.reserve(kQueryCount);
+    if (hits) {
+        for (size_t i = 0; i < kQueryCount; ++i) {
+            queries.push_back(keys[generator() % keys.size()]);
+        }
+        return queries;
+    }
+    std::vector<int> sorted(keys);
+    std::sort(sorted.begin(), sorted.end());
+    while (queries.size() < kQueryCount) {
+        int query = static_cast<int>(generator());
+        if (!std::binary_search(sorted.begin(), sorted.end(), query)) {
+            queries.push_back(query);
+        }
+    }
+    return queries;
+}
+
+// Every structure is put behind Build / Contains / GetMemoryUsage.
+struct FixedSetAdapter {
+    FixedSet set;
+
+    void Build(const std::vector<int>& keys) {
+        set.Initialize(keys);
+    }
+
+    bool Contains(int key) const {
+        return set.Contains(key);
+    }
+
+    size_t GetMemoryUsage() const {
+        return set.GetMemoryUsage();
+    }
+};
+
+struct CompactFixedSetAdapter {
+    CompactFixedSet set;
+
+    void Build(const std::vector<int>& keys) {
+        set.Initialize(keys);
+    }
+
+    bool Contains(int key) const {
+        return set.Contains(key);
+    }
+
+    size_t GetMemoryUsage() const {
+        return set.GetMemoryUsage();
+    }
+};
+
+struct UnorderedSetAdapter {
+    std::unordered_set<int> set;
+
+    void Build(const std::vector<int>& keys) {
+        set = std::unordered_set<int>(keys.begin(), keys.end());
+    }
+
+    bool Contains(int key) const {
+        return set.count(key) > 0;
+    }
+
+    // The bucket array plus one node per key holding the next pointer and the key,
+    // without allocator overhead.
+    size_t GetMemoryUsage() const {
+        return set.bucket_count() * sizeof(void*) + set.size() * 2 * sizeof(void*);
+    }
+};
+
+struct SortedVectorAdapter {
+    std::vector<int> keys;
+
+    void Build(const std::vector<int>& input) {
+        keys = input;
+        std::sort(keys.begin(), keys.end());
+    }
+
+    bool Contains(int key) const {
+        return std::binary_search(keys.begin(), keys.end(), key);
+    }
+
+    size_t GetMemoryUsage() const {
+        return keys.capacity() * sizeof(int);
+    }
+};
+
+#ifdef FIXED_SET_BENCH_ABSL
+struct FlatHashSetAdapter {
+    absl::flat_hash_set<int> set;
+
+    void Build(const std::vector<int>& keys) {
+        set = absl::flat_hash_set<int>(keys.begin(), keys.end());
+    }
+
+    bool Contains(int key) const {
+        return set.contains(key);
+    }
+
+    // One slot and one control byte per unit of capacity.
+    size_t GetMemoryUsage() const {
+        return set.capacity() * (sizeof(int) + 1);
+    }
+};
+#endif
+
+template <class Adapter>
+void BM_Build(benchmark::State& state) {
+    const auto& keys = GetKeys(static_cast<Distribution>(state.range(1)), state.range(0));
+    Adapter adapter;
+    for (auto _ : state) {
+        adapter.Build(keys);
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+    state.counters["bytes_per_key"] =
+        static_cast<double>(adapter.GetMemoryUsage()) / keys.size();
+}
+
+// Independent lookups, the processor overlaps as many of them as it can.
+template <class Adapter>
+void BM_Throughput(benchmark::State& state, bool hits) {
+    const auto& keys = GetKeys(static_cast<Distribution>(state.range(1)), state.range(0));
+    Adapter adapter;
+    adapter.Build(keys);
+    std::vector<int> queries = GetQueries(keys, hits);
+    for (auto _ : state) {
+        for (int query : queries) {
+            benchmark::DoNotOptimize(adapter.Contains(query));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * queries.size());
+    state.counters["bytes_per_key"] =
+        static_cast<double>(adapter.GetMemoryUsage()) / keys.size();
+}
+
+// Every query depends on the answer to the previous one, so lookups run back to back and
+// the time per item is the latency of one lookup.
+template <class Adapter>
+void BM_Latency(benchmark::State& state, bool hits) {
+    const auto& keys = GetKeys(static_cast<Distribution>(state.range(1)), state.range(0));
+    Adapter adapter;
+    adapter.Build(keys);
+    std::vector<int> queries = GetQueries(keys, hits);
+    for (auto _ : state) {
+        size_t index = 0;
+        for (size_t i = 0; i < queries.size(); ++i) {
+            index = (index + 1 + adapter.Contains(queries[index])) & (kQueryCount - 1);
+        }
+        benchmark::DoNotOptimize(index);
+    }
+    state.SetItemsProcessed(state.iterations() * queries.size());
+}
+
+void BM_FixedSetBatch(benchmark::State& state, bool hits) {
+    const auto& keys = GetKeys(static_cast<Distribution>(state.range(1)), state.range(0));
+    FixedSet set;
+    set.Initialize(keys);
+    std::vector<int> queries = GetQueries(keys, hits);
+    std::vector<uint8_t> answers(queries.size());
+    for (auto _ : state) {
+        set.ContainsBatch(queries.data(), queries.size(), answers.data());
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * queries.size());
+}
+
+void AddArguments(benchmark::internal::Benchmark* benchmark) {
+    benchmark->ArgNames({"keys", "distribution"});
+    for (int distribution = kSequential; distribution <= kAdversarial; ++distribution) {
+        for (size_t count = 1'000; count <= max_keys; count *= 10) {
+            benchmark->Args({static_cast<int64_t>(count), distribution});
+        }
+    }
+}
+
+template <class Adapter>
+void Register(const std::string& name) {
+    AddArguments(benchmark::RegisterBenchmark((name + "/Build").c_str(), BM_Build<Adapter>));
+    for (bool hits : {true, false}) {
+        std::string kind = hits ? "Hit" : "Miss";
+        AddArguments(benchmark::RegisterBenchmark((name + "/Throughput" + kind).c_str(),
+                                                  BM_Throughput<Adapter>, hits));
+        AddArguments(benchmark::RegisterBenchmark((name + "/Latency" + kind).c_str(),
+                                                  BM_Latency<Adapter>, hits));
+    }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    // Distributions are reported by number: 0 sequential, 1 uniform, 2 clustered,
+    // 3 adversarial. --max_keys is ours, everything else goes to the benchmark library.
+    int kept = 1;
+    for (int i = 1; i < argc; ++i) {
+        if (!std::strncmp(argv[i], "--max_keys=", 11)) {
+            max_keys = std::strtoull(argv[i] + 11, nullptr, 10);
+        } else {
+            argv[kept++] = argv[i];
+        }
+    }
+    argc = kept;
+    for (int distribution = kSequential; distribution <= kAdversarial; ++distribution) {
+        benchmark::AddCustomContext("distribution " + std::to_string(distribution),
+                                    kDistributionNames[distribution]);
+    }
+
+    Register<FixedSetAdapter>("FixedSet");
+    for (bool hits : {true, false}) {
+        AddArguments(benchmark::RegisterBenchmark(
+            hits ? "FixedSet/BatchHit" : "FixedSet/BatchMiss", BM_FixedSetBatch, hits));
+    }
+    Register<CompactFixedSetAdapter>("CompactFixedSet");
+    Register<UnorderedSetAdapter>("UnorderedSet");
+    Register<SortedVectorAdapter>("SortedVector");
+#ifdef FIXED_SET_BENCH_ABSL
+    Register<FlatHashSetAdapter>("FlatHashSet");
+#endif
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -0,0 +1,231 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "mapped_file.h"
+
+// Binary fuse filter with 8-bit fingerprints, after Graf and Lemire, "Binary Fuse Filters:
+// Fast and Smaller Than Xor Filters". It answers "maybe" for every key it was built from
+// and for about 1/256 of the others, in about 9 bits per key for a million keys and more.
+//
+// A key's 64-bit hash picks three slots in three consecutive segments of the array, and
+// the key is in the filter when the xor of the three slots equals its fingerprint. The
+// build peels the hypergraph of keys over slots: a slot that only one key maps to can be
+// given any value, so that key is set aside, and the slots are then assigned in reverse.
+// Hashes must be distinct, a repeated one makes the peeling fail.
+class BinaryFuseFilter {
+public:
+    // What a filter is besides its fingerprints, SaveTo writes it as raw memory. The array
+    // holds segment_count + 2 segments of segment_length slots each.
+    struct Params {
+        uint64_t seed;
+        uint32_t segment_length;
+        uint32_t segment_count;
+    };
+
+private:
+    static constexpr uint32_t kArity = 3;
+    static constexpr uint32_t kMaxSegmentLength = 1 << 18;
+
+    Params params_ = {};
+    uint32_t segment_length_mask_ = 0;
+    uint32_t segment_count_length_ = 0;
+    Table<uint8_t> fingerprints_;
+
+    static uint8_t GetFingerprint(uint64_t hash) noexcept {
+        return hash ^ (hash >> 32);
+    }
+
+    void GetPositions(uint64_t hash, uint32_t positions[kArity]) const noexcept {
+        positions[0] = (static_cast<__uint128_t>(hash) * segment_count_length_) >> 64;
+        positions[1] = (positions[0] + params_.segment_length) ^
+                       ((hash >> 18) & segment_length_mask_);
+        positions[2] = (positions[0] + 2 * params_.segment_length) ^
+                       (hash & segment_length_mask_);
+    }
+
+    // Sizes from the reference implementation: segments of about n^0.83 slots and
+    // 1.125 slots per key for large n, more for small ones, where peeling fails more often.
+    static Params GetParams(size_t n, uint64_t seed) {
+        Params params = {seed, 4, 1};
+        if (n == 0) {
+            return params;
+        }
+        double log_n = std::log(static_cast<double>(n));
+        params.segment_length = std::min<uint32_t>(
+            kMaxSegmentLength, 1u << static_cast<int>(std::floor(log_n / std::log(3.33) + 2.25)));
+        double size_factor = n == 1 ? 0.0 : std::max(1.125, 0.875 + 0.25 * std::log(1e6) / log_n);
+        size_t capacity = std::llround(n * size_factor);
+        int64_t segments = (capacity + params.segment_length - 1) / params.segment_length;
+        params.segment_count = std::max<int64_t>(1, segments - (kArity - 1));
+        return params;
+    }
+
+    void SetParams(const Params& params) noexcept {
+        params_ = params;
+        segment_length_mask_ = params.segment_length - 1;
+        segment_count_length_ = params.segment_count * params.segment_length;
+    }
+
+public:
+    // Number of fingerprints a filter of params holds.
+    static size_t GetArrayLength(const Params& params) noexcept {
+        return (static_cast<size_t>(params.segment_count) + kArity - 1) * params.segment_length;
+    }
+
+    // Builds the filter of hashes, which must be distinct and mixed with seed by the
+    // caller. Returns false if peeling fails, the caller then retries with another seed.
+    bool Build(const std::vector<uint64_t>& hashes, uint64_t seed) {
+        Clear();
+        Params params = GetParams(hashes.size(), seed);
+        SetParams(params);
+        size_t array_length = GetArrayLength(params);
+        // counts[p] is 4 times the number of hashes at slot p, xored with the index among
+        // their three slots of each, which for a single hash is that index. xors[p] is the
+        // xor of the hashes at p, which for a single one is that hash.
+        std::vector<uint8_t> counts(array_length, 0);
+        std::vector<uint64_t> xors(array_length, 0);
+        uint32_t positions[kArity];
+        // The first slot grows with the hash, so visiting the hashes grouped by their top
+        // bits walks the array front to back instead of all over it.
+        int block_bits = 1;
+        while ((static_cast<uint32_t>(1) << block_bits) < params.segment_count) {
+            ++block_bits;
+        }
+        std::vector<uint32_t> starts((static_cast<size_t>(1) << block_bits) + 1, 0);
+        for (uint64_t hash: hashes) {
+            ++starts[(hash >> (64 - block_bits)) + 1];
+        }
+        for (size_t b = 1; b < starts.size(); ++b) {
+            starts[b] += starts[b - 1];
+        }
+        std::vector<uint64_t> grouped(hashes.size());
+        for (uint64_t hash: hashes) {
+            grouped[starts[hash >> (64 - block_bits)]++] = hash;
+        }
+        std::vector<uint32_t>().swap(starts);
+        for (uint64_t hash: grouped) {
+            GetPositions(hash, positions);
+            for (uint32_t k = 0; k < kArity; ++k) {
+                if (counts[positions[k]] >= 252) {
+                    return false;
+                }
+                counts[positions[k]] = (counts[positions[k]] + 4) ^ k;
+                xors[positions[k]] ^= hash;
+            }
+        }
+
+        std::vector<uint32_t> alone;
+        for (uint32_t p = 0; p < array_length; ++p) {
+            if (counts[p] >> 2 == 1) {
+                alone.push_back(p);
+            }
+        }
+        std::vector<uint64_t> order;
+        std::vector<uint8_t> found;
+        order.reserve(hashes.size());
+        found.reserve(hashes.size());
+        while (!alone.empty()) {
+            uint32_t p = alone.back();
+            alone.pop_back();
+            if (counts[p] >> 2 != 1) {
+                continue;
+            }
+            uint64_t hash = xors[p];
+            uint32_t index = counts[p] & 3;
+            order.push_back(hash);
+            found.push_back(index);
+            GetPositions(hash, positions);
+            for (uint32_t k = 0; k < kArity; ++k) {
+                uint32_t q = positions[k];
+                counts[q] = (counts[q] - 4) ^ k;
+                xors[q] ^= hash;
+                if (counts[q] >> 2 == 1) {
+                    alone.push_back(q);
+                }
+            }
+        }
+        if (order.size() != hashes.size()) {
+            return false;
+        }
+
+        std::vector<uint8_t>().swap(counts);
+        std::vector<uint64_t>().swap(xors);
+        std::vector<uint64_t>().swap(grouped);
+        fingerprints_.assign(array_length, 0);
+        for (size_t i = order.size(); i-- > 0;) {
+            GetPositions(order[i], positions);
+            uint8_t fingerprint = GetFingerprint(order[i]);
+            for (uint32_t k = 0; k < kArity; ++k) {
+                if (k != found[i]) {
+                    fingerprint ^= fingerprints_[positions[k]];
+                }
+            }
+            fingerprints_[positions[found[i]]] = fingerprint;
+        }
+        return true;
+    }
+
+    // Makes the filter look at fingerprints written by SaveTo, which must stay alive.
+    // Returns false if params and size do not describe a filter.
+    bool View(const Params& params, const uint8_t* fingerprints, size_t size) {
+        if (params.segment_length == 0 || params.segment_length > kMaxSegmentLength ||
+            (params.segment_length & (params.segment_length - 1)) != 0 ||
+            params.segment_count == 0 ||
+            static_cast<uint64_t>(params.segment_count) * params.segment_length > UINT32_MAX ||
+            GetArrayLength(params) != size) {
+            return false;
+        }
+        SetParams(params);
+        fingerprints_.View(fingerprints, size);
+        return true;
+    }
+
+    void Detach() {
+        fingerprints_.Detach();
+    }
+
+    void Clear() {
+        params_ = {};
+        fingerprints_.clear();
+    }
+
+    bool Empty() const noexcept {
+        return fingerprints_.empty();
+    }
+
+    const Params& GetParams() const noexcept {
+        return params_;
+    }
+
+    uint64_t GetSeed() const noexcept {
+        return params_.seed;
+    }
+
+    const Table<uint8_t>& GetFingerprints() const noexcept {
+        return fingerprints_;
+    }
+
+    size_t GetMemoryUsage() const noexcept {
+        return fingerprints_.capacity();
+    }
+
+    void Prefetch(uint64_t hash) const noexcept {
+        uint32_t positions[kArity];
+        GetPositions(hash, positions);
+        for (uint32_t k = 0; k < kArity; ++k) {
+            __builtin_prefetch(&fingerprints_[positions[k]]);
+        }
+    }
+
+    bool Contains(uint64_t hash) const noexcept {
+        uint32_t positions[kArity];
+        GetPositions(hash, positions);
+        return (GetFingerprint(hash) ^ fingerprints_[positions[0]] ^
+                fingerprints_[positions[1]] ^ fingerprints_[positions[2]]) == 0;
+    }
+};
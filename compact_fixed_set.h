@@ -0,0 +1,168 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "fixed_set.h"
+
+// Low-memory alternative to FixedSet built on a PTHash-style perfect hash: keys are spread
+// over few buckets, and every bucket stores a 16-bit pilot chosen so that its keys land
+// on free, distinct positions of one dense key array. The table is about kLoadFactor full,
+// so a set costs roughly 4 / kLoadFactor bytes per key for the keys plus
+// 2 * kBucketDensity / log2(n) bytes per key for the pilots, instead of the ~28 bytes per
+// key of the two-level layout.
+//
+// Like FixedSet, empty positions hold a key of the set that lives elsewhere, so a lookup
+// is one pilot read, one key read and one comparison.
+//
+// Keys must be distinct, Initialize throws DuplicateKeyException otherwise.
+class CompactFixedSet {
+    using Pilot = uint16_t;
+
+    static constexpr double kLoadFactor = 0.97;
+    static constexpr double kBucketDensity = 6.0;
+    static constexpr uint32_t kMaxPilot = 0xFFFF;
+    static const int kMaxCountRun = 1000;
+
+    uint64_t seed_ = 0;
+    std::vector<Pilot> pilots_;
+    std::vector<int> keys_;
+    size_t cnt_number_ = 0;
+
+    static uint32_t Reduce(uint64_t hash, uint32_t cnt_buckets) noexcept {
+        return ((hash >> 32) * cnt_buckets) >> 32;
+    }
+
+    uint64_t GetHash(int number) const noexcept {
+        return SplitMix64(static_cast<uint32_t>(number) ^ seed_);
+    }
+
+    uint32_t GetPosition(uint64_t hash, Pilot pilot) const noexcept {
+        return Reduce(SplitMix64(hash ^ SplitMix64(pilot)), keys_.size());
+    }
+
+    // Returns false if some bucket needs a pilot above kMaxPilot, the caller then retries
+    // with another seed.
+    bool TryBuild(const std::vector<int>& numbers, uint32_t cnt_buckets, uint32_t cnt_positions) {
+        keys_.assign(cnt_positions, numbers.front());
+        pilots_.assign(cnt_buckets, 0);
+
+        std::vector<uint64_t> hashes(numbers.size());
+        std::vector<uint32_t> starts(cnt_buckets + 1, 0);
+        for (size_t i = 0; i < numbers.size(); ++i) {
+            hashes[i] = GetHash(numbers[i]);
+            starts[Reduce(hashes[i], cnt_buckets) + 1] += 1;
+        }
+        uint32_t max_len = 0;
+        for (uint32_t i = 0; i < cnt_buckets; ++i) {
+            max_len = std::max(max_len, starts[i + 1]);
+            starts[i + 1] += starts[i];
+        }
+        std::vector<uint32_t> positions(starts.begin(), starts.end() - 1);
+        std::vector<uint32_t> order(numbers.size());
+        for (size_t i = 0; i < numbers.size(); ++i) {
+            order[positions[Reduce(hashes[i], cnt_buckets)]++] = i;
+        }
+
+        // Largest buckets first, while the table is still mostly free.
+        std::vector<uint32_t> buckets(cnt_buckets);
+        for (uint32_t i = 0; i < cnt_buckets; ++i) {
+            buckets[i] = i;
+        }
+        std::stable_sort(buckets.begin(), buckets.end(), [&](uint32_t lhs, uint32_t rhs) {
+            return starts[lhs + 1] - starts[lhs] > starts[rhs + 1] - starts[rhs];
+        });
+
+        std::vector<uint8_t> taken(cnt_positions, 0);
+        std::vector<uint32_t> candidate(max_len);
+        for (uint32_t bucket: buckets) {
+            uint32_t len = starts[bucket + 1] - starts[bucket];
+            if (len == 0) {
+                break;
+            }
+            const uint32_t* keys = order.data() + starts[bucket];
+            uint32_t pilot = 0;
+            for (; pilot <= kMaxPilot; ++pilot) {
+                uint32_t placed = 0;
+                for (; placed < len; ++placed) {
+                    uint32_t position = GetPosition(hashes[keys[placed]], pilot);
+                    if (taken[position]) {
+                        break;
+                    }
+                    taken[position] = 1;
+                    candidate[placed] = position;
+                }
+                if (placed == len) {
+                    break;
+                }
+                for (uint32_t i = 0; i < placed; ++i) {
+                    taken[candidate[i]] = 0;
+                }
+            }
+            if (pilot > kMaxPilot) {
+                return false;
+            }
+            pilots_[bucket] = pilot;
+            for (uint32_t i = 0; i < len; ++i) {
+                keys_[candidate[i]] = numbers[keys[i]];
+            }
+        }
+        return true;
+    }
+
+public:
+    CompactFixedSet() = default;
+
+    void Initialize(const std::vector<int>& numbers) {
+        Initialize(numbers, Xoshiro256::DrawSeed());
+    }
+
+    void Initialize(const std::vector<int>& numbers, uint64_t seed) {
+        // Equal keys land on the same position under every pilot, so instead of exhausting
+        // every pilot of every seed, look for them first, while the set is still intact.
+        std::vector<int> sorted(numbers);
+        std::vector<int> buffer;
+        RadixSort(sorted, buffer);
+        if (std::adjacent_find(sorted.begin(), sorted.end()) != sorted.end()) {
+            throw DuplicateKeyException("Duplicate key");
+        }
+        pilots_.clear();
+        keys_.clear();
+        cnt_number_ = 0;
+        if (numbers.empty()) {
+            return;
+        }
+        double log_size = std::max(1.0, std::log2(static_cast<double>(numbers.size())));
+        uint32_t cnt_buckets = std::ceil(kBucketDensity * numbers.size() / log_size);
+        uint32_t cnt_positions = std::ceil(numbers.size() / kLoadFactor);
+        for (int count_run = 0; count_run < kMaxCountRun; ++count_run) {
+            seed_ = SplitMix64(seed + count_run);
+            if (TryBuild(numbers, cnt_buckets, cnt_positions)) {
+                cnt_number_ = numbers.size();
+                return;
+            }
+        }
+        pilots_.clear();
+        keys_.clear();
+        throw BadHashFunctionException("Bad hash function");
+    }
+
+    bool Contains(int number) const noexcept {
+        if (keys_.empty()) {
+            return false;
+        }
+        uint64_t hash = GetHash(number);
+        return keys_[GetPosition(hash, pilots_[Reduce(hash, pilots_.size())])] == number;
+    }
+
+    // Bytes held by the lookup tables.
+    size_t GetMemoryUsage() const noexcept {
+        return pilots_.capacity() * sizeof(Pilot) + keys_.capacity() * sizeof(int);
+    }
+
+    double GetBytesPerKey() const noexcept {
+        return cnt_number_ == 0 ? 0.0 : static_cast<double>(GetMemoryUsage()) / cnt_number_;
+    }
+};
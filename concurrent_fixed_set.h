@@ -0,0 +1,198 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "fixed_set.h"
+
+// A FixedSet that can be rebuilt while other threads look keys up. Every build produces a
+// new immutable snapshot off to the side, and the pointer to the current one is swapped
+// atomically, so lookups never wait for a build and never see a half-built set.
+//
+// Old snapshots are freed by epoch-based reclamation. A lookup runs through a Reader,
+// which owns one slot of a fixed table: it stores the global epoch into its slot, reads
+// the snapshot pointer, looks up and clears the slot again. That is a constant number of
+// steps whatever the writer does, so readers are wait-free. A replaced snapshot is freed
+// once no slot holds an epoch from before the swap; until then it waits in a retired list,
+// which is checked on every publish, so writers do not wait for readers either.
+template <class Key = int, class HashPolicy = typename DefaultHashPolicy<Key>::Type>
+class BasicConcurrentFixedSet {
+public:
+    using Set = BasicFixedSet<Key, HashPolicy>;
+
+private:
+    static constexpr size_t kCacheLine = 64;
+
+    // 0 while the reader is outside of a lookup, the epoch it started in otherwise.
+    struct alignas(kCacheLine) ReaderSlot {
+        std::atomic<uint64_t> epoch{0};
+        std::atomic<bool> taken{false};
+    };
+
+    struct Retired {
+        uint64_t epoch;
+        std::unique_ptr<const Set> set;
+    };
+
+    std::atomic<const Set*> current_;
+    alignas(kCacheLine) std::atomic<uint64_t> epoch_{1};
+    size_t cnt_slots_;
+    std::unique_ptr<ReaderSlot[]> slots_;
+    // Everything below belongs to writers and is guarded by write_mutex_.
+    std::mutex write_mutex_;
+    std::unique_ptr<const Set> owned_;
+    std::vector<Retired> retired_;
+
+    // Frees the retired snapshots no reader can still be looking at.
+    void Reclaim() {
+        uint64_t oldest = UINT64_MAX;
+        for (size_t i = 0; i < cnt_slots_; ++i) {
+            uint64_t epoch = slots_[i].epoch.load();
+            if (epoch != 0) {
+                oldest = std::min(oldest, epoch);
+            }
+        }
+        retired_.erase(std::remove_if(retired_.begin(), retired_.end(),
+                                      [oldest](const Retired& retired) {
+                                          return retired.epoch <= oldest;
+                                      }), retired_.end());
+    }
+
+    void PublishLocked(std::unique_ptr<const Set> set) {
+        current_.store(set.get());
+        // Readers that start from now on see the new snapshot, the old one is only
+        // visible to readers that announced an earlier epoch.
+        uint64_t epoch = epoch_.fetch_add(1) + 1;
+        retired_.push_back(Retired{epoch, std::move(owned_)});
+        owned_ = std::move(set);
+        Reclaim();
+    }
+
+public:
+    // A handle for looking keys up from one thread at a time. At most max_readers handles
+    // of a set exist at once.
+    class Reader {
+        const BasicConcurrentFixedSet* owner_;
+        ReaderSlot* slot_;
+
+        friend class BasicConcurrentFixedSet;
+
+        Reader(const BasicConcurrentFixedSet* owner, ReaderSlot* slot)
+            : owner_(owner), slot_(slot) {
+        }
+
+        // Runs lookup on the current snapshot, which stays alive until lookup returns.
+        template <class Lookup>
+        auto Read(Lookup lookup) const {
+            slot_->epoch.store(owner_->epoch_.load(std::memory_order_acquire));
+            const Set& set = *owner_->current_.load();
+            auto result = lookup(set);
+            slot_->epoch.store(0, std::memory_order_release);
+            return result;
+        }
+
+    public:
+        Reader(const Reader&) = delete;
+        Reader& operator=(const Reader&) = delete;
+
+        Reader(Reader&& other) noexcept
+            : owner_(other.owner_), slot_(std::exchange(other.slot_, nullptr)) {
+        }
+
+        Reader& operator=(Reader&& other) noexcept {
+            std::swap(owner_, other.owner_);
+            std::swap(slot_, other.slot_);
+            return *this;
+        }
+
+        ~Reader() {
+            if (slot_) {
+                slot_->taken.store(false, std::memory_order_release);
+            }
+        }
+
+        bool Contains(const Key& number) const noexcept {
+            return Read([&number](const Set& set) { return set.Contains(number); });
+        }
+
+        std::optional<uint32_t> IndexOf(const Key& number) const noexcept {
+            return Read([&number](const Set& set) { return set.IndexOf(number); });
+        }
+
+        // All n answers come from the same snapshot.
+        void ContainsBatch(const Key* keys, size_t n, uint8_t* out) const noexcept {
+            Read([&](const Set& set) {
+                set.ContainsBatch(keys, n, out);
+                return true;
+            });
+        }
+
+        size_t Size() const noexcept {
+            return Read([](const Set& set) { return set.Size(); });
+        }
+    };
+
+    explicit BasicConcurrentFixedSet(size_t max_readers = 64)
+        : cnt_slots_(max_readers), slots_(new ReaderSlot[max_readers]), owned_(new Set()) {
+        current_.store(owned_.get());
+    }
+
+    BasicConcurrentFixedSet(const BasicConcurrentFixedSet&) = delete;
+    BasicConcurrentFixedSet& operator=(const BasicConcurrentFixedSet&) = delete;
+
+    // Every Reader must be destroyed before the set.
+    ~BasicConcurrentFixedSet() = default;
+
+    // Claims a free reader slot, throws std::length_error if all max_readers are taken.
+    Reader GetReader() const {
+        for (size_t i = 0; i < cnt_slots_; ++i) {
+            bool expected = false;
+            if (!slots_[i].taken.load(std::memory_order_relaxed) &&
+                slots_[i].taken.compare_exchange_strong(expected, true,
+                                                        std::memory_order_acquire)) {
+                return Reader(this, &slots_[i]);
+            }
+        }
+        throw std::length_error("Too many readers of a ConcurrentFixedSet");
+    }
+
+    // Builds a snapshot of numbers and makes it the current one. Writers are serialized
+    // with each other, lookups go on in the old snapshot meanwhile.
+    void Initialize(const std::vector<Key>& numbers, int cnt_threads = 1) {
+        auto set = std::make_unique<Set>();
+        set->Initialize(numbers, cnt_threads);
+        Publish(std::move(set));
+    }
+
+    // Publishes a copy of the current snapshot with Set::Update applied to it, which costs
+    // a copy of the tables instead of a build.
+    void Update(const std::vector<Key>& added, const std::vector<Key>& removed) {
+        std::lock_guard<std::mutex> lock(write_mutex_);
+        auto set = std::make_unique<Set>(*owned_);
+        set->Update(added, removed);
+        PublishLocked(std::move(set));
+    }
+
+    // Makes set, built by the caller, the current snapshot.
+    void Publish(std::unique_ptr<const Set> set) {
+        std::lock_guard<std::mutex> lock(write_mutex_);
+        PublishLocked(std::move(set));
+    }
+
+    // Replaced snapshots that readers may still be using.
+    size_t GetRetiredCount() {
+        std::lock_guard<std::mutex> lock(write_mutex_);
+        Reclaim();
+        return retired_.size();
+    }
+};
+
+using ConcurrentFixedSet = BasicConcurrentFixedSet<>;
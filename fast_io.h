@@ -0,0 +1,163 @@
+#pragma once
+
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#include <unistd.h>
+
+// Reads whitespace separated decimal integers from a file descriptor in large blocks with
+// read(2) and parses them by hand, which is several times faster than std::cin >> value
+// even with sync_with_stdio(false). Accepts what operator>> accepts for valid input: any
+// amount of whitespace, an optional sign, and digits.
+class InputReader {
+    static constexpr size_t kDefaultBufferSize = 1 << 20;
+
+    int fd_;
+    size_t buffer_size_;
+    std::unique_ptr<char[]> buffer_;
+    size_t begin_ = 0;
+    size_t end_ = 0;
+    bool eof_ = false;
+
+    // Returns false at end of input.
+    bool Refill() {
+        if (eof_) {
+            return false;
+        }
+        ssize_t read_bytes;
+        do {
+            read_bytes = read(fd_, buffer_.get(), buffer_size_);
+        } while (read_bytes < 0 && errno == EINTR);
+        if (read_bytes < 0) {
+            throw std::runtime_error(std::string("Read failed: ") + std::strerror(errno));
+        }
+        begin_ = 0;
+        end_ = read_bytes;
+        eof_ = read_bytes == 0;
+        return !eof_;
+    }
+
+    static bool IsSpace(char c) noexcept {
+        return c == ' ' || (c >= '\t' && c <= '\r');
+    }
+
+    static bool IsDigit(char c) noexcept {
+        return static_cast<unsigned char>(c - '0') < 10;
+    }
+
+    // The next character, or '\0' at end of input.
+    char Peek() {
+        if (begin_ == end_ && !Refill()) {
+            return '\0';
+        }
+        return buffer_[begin_];
+    }
+
+public:
+    explicit InputReader(int fd, size_t buffer_size = kDefaultBufferSize) :
+    fd_(fd), buffer_size_(buffer_size), buffer_(new char[buffer_size]) {
+    }
+
+    // Parses the next integer into value. Returns false if only whitespace is left and
+    // throws if the next token is not a number. The value must fit into Integer.
+    template <class Integer>
+    bool Read(Integer& value) {
+        static_assert(std::is_integral_v<Integer>, "InputReader parses integers only");
+        using Unsigned = std::make_unsigned_t<Integer>;
+
+        char c;
+        while (IsSpace(c = Peek())) {
+            ++begin_;
+        }
+        if (c == '\0') {
+            return false;
+        }
+        bool negative = false;
+        if (c == '-' || c == '+') {
+            negative = c == '-';
+            ++begin_;
+            c = Peek();
+        }
+        if (!IsDigit(c)) {
+            throw std::runtime_error("Expected a number in the input");
+        }
+        Unsigned magnitude = 0;
+        do {
+            // The inner loop runs over the buffered digits without checking for a refill.
+            const char* current = buffer_.get() + begin_;
+            const char* end = buffer_.get() + end_;
+            while (current != end && IsDigit(*current)) {
+                magnitude = magnitude * 10 + static_cast<Unsigned>(*current - '0');
+                ++current;
+            }
+            begin_ = current - buffer_.get();
+        } while (begin_ == end_ && Refill() && IsDigit(buffer_[begin_]));
+        value = static_cast<Integer>(negative ? Unsigned(0) - magnitude : magnitude);
+        return true;
+    }
+};
+
+// Collects output in one large buffer and hands it to write(2) only when the buffer fills
+// up or on Flush, so printing costs a memcpy per call and no allocations.
+class OutputWriter {
+    static constexpr size_t kDefaultBufferSize = 1 << 20;
+
+    int fd_;
+    size_t buffer_size_;
+    std::unique_ptr<char[]> buffer_;
+    size_t size_ = 0;
+
+    void WriteAll(const char* data, size_t size) {
+        while (size > 0) {
+            ssize_t written = write(fd_, data, size);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::runtime_error(std::string("Write failed: ") + std::strerror(errno));
+            }
+            data += written;
+            size -= written;
+        }
+    }
+
+public:
+    explicit OutputWriter(int fd, size_t buffer_size = kDefaultBufferSize) :
+    fd_(fd), buffer_size_(buffer_size), buffer_(new char[buffer_size]) {
+    }
+
+    OutputWriter(const OutputWriter&) = delete;
+    OutputWriter& operator=(const OutputWriter&) = delete;
+
+    // Errors are only reported by an explicit Flush.
+    ~OutputWriter() {
+        try {
+            Flush();
+        } catch (...) {
+        }
+    }
+
+    void Write(std::string_view text) {
+        if (text.size() > buffer_size_ - size_) {
+            Flush();
+            if (text.size() > buffer_size_) {
+                WriteAll(text.data(), text.size());
+                return;
+            }
+        }
+        std::memcpy(buffer_.get() + size_, text.data(), text.size());
+        size_ += text.size();
+    }
+
+    void Flush() {
+        size_t size = size_;
+        size_ = 0;
+        WriteAll(buffer_.get(), size);
+    }
+};
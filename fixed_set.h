@@ -1,8 +1,33 @@
+#pragma once
+
 #include <vector>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
 #include <random>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <chrono>
+#include <cmath>
+
+#include "binary_fuse_filter.h"
+#include "huge_page_allocator.h"
+#include "key_hash_functions.h"
+#include "linear_hash_simd.h"
+#include "lookup_stats.h"
+#include "mapped_file.h"
+#include "parallel_for.h"
+#include "radix_sort.h"
+#include "random_generator.h"
 
 class BadHashFunctionException : public std::exception {
     std::string error_message_;
@@ -16,189 +41,1961 @@ public:
     }
 };
 
+// Thrown by Initialize for a key that occurs twice unless duplicates are removed, see
+// DuplicateKeys. Derives from BadHashFunctionException, which such inputs used to raise.
+class DuplicateKeyException : public BadHashFunctionException {
+public:
+    using BadHashFunctionException::BadHashFunctionException;
+};
+
+// What Initialize does with keys that occur more than once. kReject throws
+// DuplicateKeyException as soon as the second level meets one, or once the first level
+// fails because of one, which is what a key repeated more than about sqrt(2n) times does.
+// kRemove sorts a copy of the keys first, with a radix sort for integers, and builds the
+// set of the distinct ones.
+enum class DuplicateKeys {
+    kReject,
+    kRemove,
+};
+
 class LinearHashFunction {
     int coefficien_;
     int bias_;
     int k_prime_;
-    int64_t not_negative_value_;
-    static const int64_t kMaxValue = 1000000000;
+    // -kMaxValue is the smallest int, so the dividend below is never negative.
+    static const int64_t kMaxValue = static_cast<int64_t>(1) << 31;
 
 public:
-    LinearHashFunction(int coefficien, int bias, int k_prime) :
-    coefficien_(coefficien), bias_(bias), k_prime_(k_prime),
-    not_negative_value_(k_prime_ * kMaxValue) {
+    constexpr LinearHashFunction(int coefficien, int bias, int k_prime) :
+    coefficien_(coefficien), bias_(bias), k_prime_(k_prime) {
     }
 
-    int GetHash(int value) const {
-        int ans =  (static_cast<int64_t>(value) * coefficien_ +
-            bias_ + not_negative_value_) % k_prime_;
-        if (ans < 0) {
-            throw BadHashFunctionException("ans < 0");
-        }
-        return ans;
+    constexpr int GetHash(int value) const noexcept {
+        return (static_cast<int64_t>(value) * coefficien_ +
+            bias_ + k_prime_ * kMaxValue) % k_prime_;
+    }
+
+    constexpr int GetCoefficien() const noexcept {
+        return coefficien_;
+    }
+
+    constexpr int GetBias() const noexcept {
+        return bias_;
     }
 };
 
 class GenerateLinearHashFunction {
-    std::mt19937 generator_;
+    Xoshiro256 generator_;
 
 public:
     static const int kPrime = 1000000021;
 
-    GenerateLinearHashFunction() : generator_(std::random_device()()) {
+    GenerateLinearHashFunction() = default;
+
+    explicit constexpr GenerateLinearHashFunction(uint64_t seed) : generator_(seed) {
     }
 
-    LinearHashFunction Generate() {
-        std::uniform_int_distribution<int> distribution_coefficien(1, kPrime - 1);
-        std::uniform_int_distribution<int> distribution_bias(0, kPrime - 1);
-        int coefficien = distribution_coefficien(generator_);
-        int bias = distribution_bias(generator_);
+    constexpr LinearHashFunction Generate() {
+        int coefficien = 1 + generator_.Uniform(kPrime - 1);
+        int bias = generator_.Uniform(kPrime);
         return LinearHashFunction(coefficien, bias, kPrime);
     }
 };
 
+// Dietzfelbinger's multiply-add-shift: the high half of a * x + b modulo 2^64.
+// Costs one multiply and no division.
+class MultiplyShiftHashFunction {
+    uint64_t coefficien_;
+    uint64_t bias_;
 
-class FixedSet {
-    class InnerSet {
-        std::optional<LinearHashFunction> hash_;
-        std::vector<std::optional<int>> data_;
+public:
+    MultiplyShiftHashFunction(uint64_t coefficien, uint64_t bias) :
+    coefficien_(coefficien), bias_(bias) {
+    }
 
-        static std::vector<std::optional<int>> Split(
-                const std::vector<int>& numbers,
-                LinearHashFunction& hash,
-                int cnt_buckets) {
-                std::vector<std::optional<int>> buckets(cnt_buckets);
-            for (int v: numbers) {
-                int index = hash.GetHash(v) % cnt_buckets;
-                buckets[index].emplace(v);
-            }
-            return buckets;
+    uint32_t GetHash(int value) const noexcept {
+        return (coefficien_ * static_cast<uint32_t>(value) + bias_) >> 32;
+    }
+};
+
+class GenerateMultiplyShiftHashFunction {
+    Xoshiro256 generator_;
+
+public:
+    GenerateMultiplyShiftHashFunction() = default;
+
+    explicit GenerateMultiplyShiftHashFunction(uint64_t seed) : generator_(seed) {
+    }
+
+    MultiplyShiftHashFunction Generate() {
+        return MultiplyShiftHashFunction(generator_(), generator_());
+    }
+};
+
+// Lemire's fastrange: maps a 32-bit hash onto [0, cnt_buckets) with a multiply and a shift.
+inline uint32_t FastRange(uint32_t hash, uint32_t cnt_buckets) noexcept {
+    return (static_cast<uint64_t>(hash) * cnt_buckets) >> 32;
+}
+
+// A hash policy tells FixedSet which hash family to draw from and how to map a hash
+// value onto [0, cnt_buckets). kFormatTag identifies the policy in saved sets.
+struct LinearHashPolicy {
+    using HashFunction = LinearHashFunction;
+    using Generator = GenerateLinearHashFunction;
+    static constexpr uint32_t kFormatTag = 1;
+
+    static constexpr uint32_t Reduce(uint32_t hash, uint32_t cnt_buckets) noexcept {
+        return hash % cnt_buckets;
+    }
+};
+
+// Division-free alternative: multiply-shift hashing with fastrange reduction.
+struct MultiplyShiftHashPolicy {
+    using HashFunction = MultiplyShiftHashFunction;
+    using Generator = GenerateMultiplyShiftHashFunction;
+    static constexpr uint32_t kFormatTag = 2;
+
+    static uint32_t Reduce(uint32_t hash, uint32_t cnt_buckets) noexcept {
+        return FastRange(hash, cnt_buckets);
+    }
+};
+
+struct MultiplyShift64HashPolicy {
+    using HashFunction = MultiplyShift64HashFunction;
+    using Generator = GenerateMultiplyShift64HashFunction;
+    static constexpr uint32_t kFormatTag = 3;
+
+    static uint32_t Reduce(uint32_t hash, uint32_t cnt_buckets) noexcept {
+        return FastRange(hash, cnt_buckets);
+    }
+};
+
+struct StringHashPolicy {
+    using HashFunction = StringHashFunction;
+    using Generator = GenerateStringHashFunction;
+    static constexpr uint32_t kFormatTag = 4;
+
+    static uint32_t Reduce(uint32_t hash, uint32_t cnt_buckets) noexcept {
+        return FastRange(hash, cnt_buckets);
+    }
+};
+
+// The policy BasicFixedSet<Key> uses when none is given.
+template <class Key>
+struct DefaultHashPolicy;
+
+template <>
+struct DefaultHashPolicy<int> {
+    using Type = LinearHashPolicy;
+};
+
+template <>
+struct DefaultHashPolicy<int64_t> {
+    using Type = MultiplyShift64HashPolicy;
+};
+
+template <>
+struct DefaultHashPolicy<uint64_t> {
+    using Type = MultiplyShift64HashPolicy;
+};
+
+template <>
+struct DefaultHashPolicy<std::string_view> {
+    using Type = StringHashPolicy;
+};
+
+// How BasicFixedSet keeps keys in its slots. Integers are stored as they are.
+template <class Key>
+class KeyStorage {
+public:
+    using Slot = Key;
+    static constexpr uint32_t kFormatTag = sizeof(Key) | (std::is_signed_v<Key> << 8);
+
+    // Returns the keys the build should work on, they must stay valid until Release.
+    const std::vector<Key>& Adopt(const std::vector<Key>& keys) {
+        return keys;
+    }
+
+    // Same as Adopt, but keeps the keys adopted before.
+    const std::vector<Key>& Append(const std::vector<Key>& keys) {
+        return keys;
+    }
+
+    // Makes the storage writable after ViewBlob.
+    void Detach() {
+    }
+
+    void Release() {
+    }
+
+    void Clear() {
+    }
+
+    Slot ToSlot(const Key& key) const noexcept {
+        return key;
+    }
+
+    const Key& FromSlot(const Slot& slot) const noexcept {
+        return slot;
+    }
+
+    size_t GetMemoryUsage() const noexcept {
+        return 0;
+    }
+
+    // Key bytes that live outside the slots, for saving the set.
+    std::string_view GetBlob() const noexcept {
+        return std::string_view();
+    }
+
+    // Takes the key bytes from memory owned elsewhere, for loading a saved set.
+    void ViewBlob(const char*, size_t) {
+    }
+};
+
+// Strings are copied into one contiguous blob and a slot is an (offset, size) reference
+// into it, so there is no per-key allocation and a lookup reads the bytes from one place.
+template <>
+class KeyStorage<std::string_view> {
+    Table<char> blob_;
+    std::vector<std::string_view> keys_;
+
+public:
+    struct Slot {
+        uint32_t offset;
+        uint32_t size;
+    };
+    static constexpr uint32_t kFormatTag = 1 << 16;
+
+    // Copies the keys into the blob and returns views of the copies.
+    const std::vector<std::string_view>& Adopt(const std::vector<std::string_view>& keys) {
+        blob_.clear();
+        return Append(keys);
+    }
+
+    // Copies the keys to the end of the blob, which may move it: views returned before are
+    // invalidated, slots are not.
+    const std::vector<std::string_view>& Append(const std::vector<std::string_view>& keys) {
+        size_t total_size = blob_.size();
+        for (std::string_view key: keys) {
+            total_size += key.size();
         }
+        if (total_size > UINT32_MAX) {
+            throw std::length_error("FixedSet keys exceed 4 GiB");
+        }
+        size_t offset = blob_.size();
+        blob_.Detach();
+        blob_.resize(total_size);
+        keys_.resize(keys.size());
+        for (size_t i = 0; i < keys.size(); ++i) {
+            std::memcpy(blob_.data() + offset, keys[i].data(), keys[i].size());
+            keys_[i] = std::string_view(blob_.data() + offset, keys[i].size());
+            offset += keys[i].size();
+        }
+        return keys_;
+    }
 
-    public:
-        InnerSet() = default;
+    void Release() {
+        std::vector<std::string_view>().swap(keys_);
+    }
 
-        void Initialize(const std::vector<int>& numbers, GenerateLinearHashFunction& generator) {
-            int cnt_number = numbers.size();
-            int cnt_buckets = cnt_number * cnt_number;
-            if (cnt_buckets == 0) {
-                return;
+    void Clear() {
+        blob_.clear();
+    }
+
+    // key must be one of the views returned by the last Adopt or Append.
+    Slot ToSlot(std::string_view key) const noexcept {
+        return Slot{static_cast<uint32_t>(key.data() - blob_.data()),
+                    static_cast<uint32_t>(key.size())};
+    }
+
+    std::string_view FromSlot(const Slot& slot) const noexcept {
+        return std::string_view(blob_.data() + slot.offset, slot.size);
+    }
+
+    size_t GetMemoryUsage() const noexcept {
+        return blob_.capacity();
+    }
+
+    std::string_view GetBlob() const noexcept {
+        return std::string_view(blob_.data(), blob_.size());
+    }
+
+    void ViewBlob(const char* data, size_t size) {
+        blob_.View(data, size);
+    }
+
+    void Detach() {
+        blob_.Detach();
+    }
+};
+
+// On-disk layout of a saved FixedSet: this header followed by the lookup tables, each at a
+// kAlignment aligned offset and in the in-memory layout of the machine that wrote it. A
+// loaded set maps the file and looks keys up in place, so loading costs no parsing and
+// processes mapping one file share its pages. Files are only readable by the same key type
+// and hash policy on a machine of the same byte order, which the header records.
+struct FixedSetFileHeader {
+    enum Section {
+        kHash, kBuckets, kSlots, kOccupied, kRanks, kBlob, kFilterParams, kFilter, kCntSections
+    };
+
+    static constexpr char kMagic[8] = {'F', 'I', 'X', 'E', 'D', 'S', 'E', 'T'};
+    // 3: the shared slot of empty buckets is the first one instead of the last.
+    // 4: the sections of the prefilter, empty for a set without one.
+    // 5: records padded to a cache line carry a copy of small tables.
+    static constexpr uint32_t kVersion = 5;
+    // Reads as 0x04030201 on a machine of the other byte order.
+    static constexpr uint32_t kByteOrderMark = 0x01020304;
+    static constexpr uint64_t kAlignment = 64;
+
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t key_tag;
+    uint32_t policy_tag;
+    uint32_t bucket_size;
+    uint32_t slot_size;
+    uint64_t file_size;
+    uint64_t seed;
+    uint64_t section_offsets[kCntSections];
+    uint64_t section_sizes[kCntSections];
+    // FixedSetChecksum of the sections in order.
+    uint64_t checksum;
+};
+
+// FNV-1a over 64-bit words with the tail bytes folded in one by one. Running at a word
+// per multiply it verifies a multi-gigabyte file in about a second.
+class FixedSetChecksum {
+    static constexpr uint64_t kPrime = 0x100000001b3;
+    uint64_t state_ = 0xcbf29ce484222325;
+
+public:
+    void Update(const char* data, size_t size) noexcept {
+        for (; size >= sizeof(uint64_t); data += sizeof(uint64_t), size -= sizeof(uint64_t)) {
+            uint64_t word;
+            std::memcpy(&word, data, sizeof(word));
+            state_ = (state_ ^ word) * kPrime;
+        }
+        for (; size > 0; ++data, --size) {
+            state_ = (state_ ^ static_cast<unsigned char>(*data)) * kPrime;
+        }
+    }
+
+    uint64_t Get() const noexcept {
+        return state_;
+    }
+};
+
+// Scratch memory of FixedSet::Initialize. Buffers only grow, so once an arena has served a
+// build of some size, further builds of at most that size allocate nothing in it. Every
+// set owns one; passing a shared arena lets several sets reuse the same buffers instead.
+template <class Key>
+class BasicFixedSetArena {
+    struct WorkerScratch {
+        std::vector<int> lens;
+        std::vector<uint8_t> used;
+        // Second-level hash functions drawn by the worker during the current build.
+        size_t attempts;
+        int max_attempts;
+    };
+
+    std::vector<int> lens_;
+    std::vector<int> starts_;
+    std::vector<int> positions_;
+    std::vector<Key> scattered_;
+    std::vector<Key> unique_;
+    std::unique_ptr<std::atomic<int>[]> counters_;
+    size_t counters_size_ = 0;
+    std::vector<WorkerScratch> workers_;
+
+    std::atomic<int>* GetCounters(size_t size) {
+        if (counters_size_ < size) {
+            counters_.reset(new std::atomic<int>[size]);
+            counters_size_ = size;
+        }
+        return counters_.get();
+    }
+
+    WorkerScratch& GetWorker(int worker) {
+        return workers_[worker];
+    }
+
+    void Reserve(int cnt_threads) {
+        if (static_cast<int>(workers_.size()) < cnt_threads) {
+            workers_.resize(cnt_threads);
+        }
+    }
+
+    template <class, class, class, bool>
+    friend class BasicFixedSet;
+
+public:
+    BasicFixedSetArena() = default;
+
+    // Scratch contents are never worth copying, a copy starts empty.
+    BasicFixedSetArena(const BasicFixedSetArena&) {
+    }
+
+    BasicFixedSetArena& operator=(const BasicFixedSetArena&) {
+        return *this;
+    }
+
+    BasicFixedSetArena(BasicFixedSetArena&&) = default;
+    BasicFixedSetArena& operator=(BasicFixedSetArena&&) = default;
+
+    // Gives back all scratch memory.
+    void Clear() {
+        *this = BasicFixedSetArena();
+    }
+
+    // Bytes of scratch memory held.
+    size_t GetMemoryUsage() const noexcept {
+        size_t usage = lens_.capacity() * sizeof(int) + starts_.capacity() * sizeof(int) +
+                       positions_.capacity() * sizeof(int) +
+                       (scattered_.capacity() + unique_.capacity()) * sizeof(Key) +
+                       counters_size_ * sizeof(std::atomic<int>) +
+                       workers_.capacity() * sizeof(WorkerScratch);
+        for (const WorkerScratch& worker: workers_) {
+            usage += worker.lens.capacity() * sizeof(int) + worker.used.capacity();
+        }
+        return usage;
+    }
+};
+
+using FixedSetArena = BasicFixedSetArena<int>;
+
+// What the last FixedSet::Initialize did, to watch build cost and catch key distributions
+// that push the hash searches towards their limit.
+struct BuildStats {
+    uint64_t seed = 0;
+    size_t cnt_keys = 0;
+    // Repeated keys dropped by DuplicateKeys::kRemove.
+    size_t cnt_duplicates = 0;
+    // Hash functions drawn by the first-level search, which gives up after max_attempts,
+    // and its final table size, above cnt_keys if failed attempts made it grow the table.
+    int first_level_attempts = 0;
+    size_t cnt_buckets = 0;
+    int max_attempts = 0;
+    // Sum of squared bucket sizes of the accepted first-level hash, at most square_sum_bound.
+    uint64_t square_sum = 0;
+    uint64_t square_sum_bound = 0;
+    // Hash functions drawn for all buckets of more than two keys together and for the worst
+    // of them, smaller buckets are scanned instead of hashed.
+    size_t second_level_attempts = 0;
+    int max_bucket_attempts = 0;
+    // bucket_size_histogram[s] is the number of first-level buckets holding s keys.
+    std::vector<size_t> bucket_size_histogram;
+    // Bytes of the lookup tables and of the build scratch memory left in the arena.
+    size_t memory_usage = 0;
+    size_t scratch_memory_usage = 0;
+    double bytes_per_key = 0;
+    // Wall-clock time per phase.
+    double first_level_seconds = 0;
+    double split_seconds = 0;
+    double second_level_seconds = 0;
+    double rank_seconds = 0;
+    double filter_seconds = 0;
+};
+
+template <class Key, class HashPolicy, class AllocationPolicy>
+class BasicFixedSetFileBuilder;
+
+// First-level record of BasicFixedSet, see there. Records aligned wider than their fields
+// keep a copy of tables of up to InlineSlots slots in what would be padding.
+template <class HashFunction, class Slot, size_t RecordAlignment, size_t InlineSlots>
+struct alignas(HashFunction) alignas(RecordAlignment) FixedSetBucket {
+    uint32_t offset;
+    uint32_t size;
+    HashFunction hash;
+    Slot inline_slots[InlineSlots] = {};
+};
+
+template <class HashFunction, class Slot, size_t RecordAlignment>
+struct alignas(HashFunction) alignas(RecordAlignment)
+    FixedSetBucket<HashFunction, Slot, RecordAlignment, 0> {
+    uint32_t offset;
+    uint32_t size;
+    HashFunction hash;
+};
+
+// AllocationPolicy is StandardAllocation, AlignedAllocation or HugePageAllocation, see
+// huge_page_allocator.h.
+// An Instrumented set counts its lookups, see lookup_stats.h and GetLookupStats; without
+// the flag none of that code is compiled in.
+template <class Key = int, class HashPolicy = typename DefaultHashPolicy<Key>::Type,
+          class AllocationPolicy = StandardAllocation, bool Instrumented = false>
+class BasicFixedSet {
+    template <class T>
+    using TableOf = Table<T, typename AllocationPolicy::template Allocator<T>>;
+
+    using HashFunction = typename HashPolicy::HashFunction;
+    using Generator = typename HashPolicy::Generator;
+    using Storage = KeyStorage<Key>;
+    using Slot = typename Storage::Slot;
+    using Arena = BasicFixedSetArena<Key>;
+
+    // All second-level tables live in one contiguous array of slots, each first-level
+    // bucket only remembers where its table starts, how long it is and its hash.
+    //
+    // There are no empty markers: a free slot holds a key of the set that hashes to some
+    // other slot, so no query that reaches the free slot can be equal to it. Empty buckets
+    // are one-slot tables that share a slot holding an arbitrary key. A lookup therefore
+    // ends with a single comparison and never branches on occupancy.
+    //
+    // Buckets of up to kScanSize keys skip the second-level hash: their keys fill exactly
+    // size slots in ascending order and a lookup compares against them. Every key in slots_
+    // belongs to one first-level bucket only, so matching one is as good as hashing to it.
+    //
+    // When records are aligned to a cache line, the padding after the hash holds
+    // kInlineSlots slots, and buckets whose table fits there keep a copy of it in their
+    // record. A lookup in such a bucket reads its record and nothing else, with the linear
+    // policy and int keys that covers tables of up to 11 slots: every scanned bucket and the
+    // hashed ones of three keys. slots_ stays the table every other path reads and writes.
+    using BareBucket = FixedSetBucket<HashFunction, Slot, AllocationPolicy::kRecordAlignment, 0>;
+    static constexpr uint32_t kInlineSlots =
+        (sizeof(BareBucket) - offsetof(BareBucket, hash) - sizeof(HashFunction)) / sizeof(Slot);
+    using Bucket =
+        FixedSetBucket<HashFunction, Slot, AllocationPolicy::kRecordAlignment, kInlineSlots>;
+    static_assert(sizeof(Bucket) == sizeof(BareBucket), "Inline slots must fit the padding");
+
+    static constexpr bool kIntKeys = std::is_same_v<Key, int>;
+    static constexpr bool kVectorizable =
+        kIntKeys && std::is_same_v<HashPolicy, LinearHashPolicy>;
+    // linear_hash_simd::ComputeSlotsAvx2 reads records as consecutive ints.
+    static_assert(!kVectorizable || (offsetof(Bucket, hash) == 2 * sizeof(int) &&
+                                     sizeof(Bucket) % sizeof(int) == 0),
+                  "Bucket must be readable as ints");
+
+    std::optional<HashFunction> hash_;
+    TableOf<Bucket> buckets_;
+    Storage storage_;
+    TableOf<Slot> slots_;
+    // Rank directory over slot occupancy: bit j of occupied_ tells whether slot j holds its
+    // own key, ranks_[w] counts the occupied slots before word w. It turns a slot index
+    // into a dense key index for IndexOf.
+    TableOf<uint64_t> occupied_;
+    TableOf<uint32_t> ranks_;
+    // Backs the tables of a set read by LoadFrom.
+    std::shared_ptr<const MappedFile> mapping_;
+    uint64_t seed_ = 0;
+    BuildStats stats_;
+    DuplicateKeys duplicate_keys_ = DuplicateKeys::kReject;
+    // Slots no bucket points to any more, left behind by Update, and the number of
+    // updates since the last build, which seeds the generator of the next one.
+    uint64_t cnt_garbage_slots_ = 0;
+    uint64_t cnt_updates_ = 0;
+    // Optional first tier of every lookup, see SetPrefilter.
+    bool prefilter_ = false;
+    BinaryFuseFilter filter_;
+    std::conditional_t<Instrumented, LookupStats, NoLookupStats> lookup_stats_;
+    Arena arena_;
+
+    template <class, class, class>
+    friend class BasicFixedSetFileBuilder;
+
+    static const int kMaxCountRun = 1000;
+    // The first-level search widens the table by 1/kGrowthDivisor after every kRelaxEvery
+    // failed attempts, up to kMaxGrowth buckets per key.
+    static const int kRelaxEvery = 8;
+    static const uint32_t kGrowthDivisor = 8;
+    static const uint32_t kMaxGrowth = 2;
+    static constexpr size_t kBatchSize = 8;
+    // Groups between two stages of ContainsBatch.
+    static constexpr size_t kPrefetchDistance = 3;
+    static constexpr uint32_t kScanSize = 2;
+    // Slot of every empty bucket. Tables start after it, so that Update can append tables
+    // without moving it.
+    static constexpr uint32_t kSharedSlot = 0;
+    // Granularity of the parallel build: small enough to balance skewed buckets between
+    // threads, large enough to keep the shared task counter cold.
+    static constexpr size_t kKeysPerTask = 1 << 16;
+    static constexpr size_t kBucketsPerTask = 1 << 10;
+    // The vector kernel addresses bucket records with 32-bit indices of ints.
+    static constexpr size_t kMaxVectorizedBuckets =
+        (static_cast<size_t>(1) << 31) / (sizeof(Bucket) / sizeof(int));
+
+    static uint32_t GetIndex(const HashFunction& hash, const Key& number,
+                             uint32_t cnt_buckets) noexcept {
+        return HashPolicy::Reduce(hash.GetHash(number), cnt_buckets);
+    }
+
+    // The 64-bit hash of number the prefilter is built from. Integers are mixed by a
+    // bijection, so distinct keys always get distinct hashes.
+    static uint64_t GetFilterHash(const Key& number, uint64_t seed) noexcept {
+        if constexpr (std::is_integral_v<Key>) {
+            return SplitMix64(static_cast<uint64_t>(number) + seed);
+        } else {
+            return StringHashFunction(seed, SplitMix64(seed) | 1).GetHash64(number);
+        }
+    }
+
+    bool MayContain(const Key& number) const noexcept {
+        return filter_.Empty() || filter_.Contains(GetFilterHash(number, filter_.GetSeed()));
+    }
+
+    const Bucket& GetBucket(const Key& number) const noexcept {
+        return buckets_[GetIndex(*hash_, number, buckets_.size())];
+    }
+
+    // Counts where the lookup of number in bucket ends.
+    static void CountBucket(LookupStats::Counters& counters, const Bucket& bucket) noexcept {
+        LookupStats::Add(bucket.offset == kSharedSlot ? counters.empty_bucket
+                         : bucket.size <= kScanSize  ? counters.scanned_bucket
+                                                     : counters.hashed_bucket);
+    }
+
+    // Contains without the LookupStats hooks, for lookups that are not queries, like the
+    // ones of Update.
+    bool ContainsUncounted(const Key& number) const noexcept {
+        if (slots_.empty() || !MayContain(number)) {
+            return false;
+        }
+        const Bucket& bucket = GetBucket(number);
+        const Slot* table = GetTable(bucket);
+        return storage_.FromSlot(table[GetPosition(bucket, table, number)]) == number;
+    }
+
+    // The slot of number if it is in the set, with the lookup counted.
+    std::optional<uint32_t> FindCounted(const Key& number) const noexcept {
+        LookupStats::Counters& counters = lookup_stats_.Local();
+        bool sampled = LookupStats::ShouldSample(counters);
+        uint64_t start = sampled ? ReadCycles() : 0;
+        std::optional<uint32_t> slot;
+        if (!slots_.empty() && !MayContain(number)) {
+            LookupStats::Add(counters.filtered);
+        } else if (!slots_.empty()) {
+            const Bucket& bucket = GetBucket(number);
+            CountBucket(counters, bucket);
+            const Slot* table = GetTable(bucket);
+            uint32_t position = GetPosition(bucket, table, number);
+            if (storage_.FromSlot(table[position]) == number) {
+                slot = bucket.offset + position;
+            }
+        }
+        if (sampled) {
+            LookupStats::RecordLatency(counters, ReadCycles() - start);
+        }
+        LookupStats::Add(counters.lookups);
+        LookupStats::Add(counters.hits, slot.has_value());
+        return slot;
+    }
+
+    // The table of bucket to look keys up in: its copy in the record when there is one.
+    const Slot* GetTable(const Bucket& bucket) const noexcept {
+        if constexpr (kInlineSlots > 0) {
+            if (bucket.size <= kInlineSlots) {
+                return bucket.inline_slots;
             }
-            // X % 0 - is UB
-            hash_ = GetHashFunction(
-                cnt_buckets, numbers,
-                [](const std::vector<int>& lens) {
-                    return std::all_of(lens.begin(), lens.end(),
-                        [](int element) { return element <= 1; });
-                }, generator);
-            data_ = Split(
-                numbers,
-                hash_.value(),
-                cnt_buckets);
         }
+        return slots_.data() + bucket.offset;
+    }
+
+    // Where number would sit in table, the table of bucket, with the second slot of a
+    // two-key bucket picked only if it holds number.
+    uint32_t GetPosition(const Bucket& bucket, const Slot* table,
+                         const Key& number) const noexcept {
+        if (bucket.size > kScanSize) {
+            return GetIndex(bucket.hash, number, bucket.size);
+        }
+        return bucket.size == kScanSize && storage_.FromSlot(table[1]) == number;
+    }
+
+    // The slot number would occupy.
+    uint32_t GetSlotIndex(const Bucket& bucket, const Key& number) const noexcept {
+        return bucket.offset + GetPosition(bucket, slots_.data() + bucket.offset, number);
+    }
 
-        bool Contains(int number) const {
-            int cnt_buckets = data_.size();
-            if (cnt_buckets == 0) {
-                return false;
+    // Refreshes the copy of the table of bucket in its record.
+    void CopyInline(Bucket& bucket) noexcept {
+        if constexpr (kInlineSlots > 0) {
+            if (bucket.size <= kInlineSlots) {
+                std::copy_n(slots_.data() + bucket.offset, bucket.size, bucket.inline_slots);
             }
-            int index = hash_.value().GetHash(number) % cnt_buckets;
-            if (data_[index].has_value()) {
-                return data_[index].value() == number;
-            } else {
-                return false;
+        }
+    }
+
+    // The slot of number without reading slots_: the first one of a scanned bucket.
+    static uint32_t GetFirstSlotIndex(const Bucket& bucket, const Key& number) noexcept {
+        if (bucket.size <= kScanSize) {
+            return bucket.offset;
+        }
+        return bucket.offset + GetIndex(bucket.hash, number, bucket.size);
+    }
+
+    // Widens a first-level table that keeps failing, which lowers the expected sum of
+    // squares, so an unlucky input costs a few more attempts instead of all of them. The
+    // table stops at kMaxGrowth buckets per key: an input that still fails there is not
+    // unlucky, and wider tables would only make the remaining attempts slower.
+    static void Relax(int count_run, uint64_t cnt_keys, uint32_t& cnt_buckets) noexcept {
+        if (count_run > 1 && (count_run - 1) % kRelaxEvery == 0) {
+            uint64_t cap = std::min<uint64_t>(kMaxGrowth * cnt_keys,
+                                              std::numeric_limits<uint32_t>::max());
+            uint64_t grown = cnt_buckets + static_cast<uint64_t>(cnt_buckets / kGrowthDivisor) + 1;
+            cnt_buckets = std::max<uint64_t>(cnt_buckets, std::min(grown, cap));
+        }
+    }
+
+    // Throws DuplicateKeyException if the keys of [begin, end) that hash to bucket hold
+    // one twice.
+    static void CheckBucket(const HashFunction& hash, uint32_t cnt_buckets, uint32_t bucket,
+                            const Key* begin, const Key* end) {
+        std::vector<Key> keys;
+        for (const Key* it = begin; it != end; ++it) {
+            if (GetIndex(hash, *it, cnt_buckets) == bucket) {
+                keys.push_back(*it);
             }
         }
-    };
+        std::sort(keys.begin(), keys.end());
+        if (std::adjacent_find(keys.begin(), keys.end()) != keys.end()) {
+            throw DuplicateKeyException("Duplicate key");
+        }
+    }
 
-    std::optional<LinearHashFunction> hash_;
-    std::vector<InnerSet> data_;
-    static const int kMaxCountRun = 1000;
+    // Runs CheckBucket on the largest bucket of [begin, end) under hash. A key repeated
+    // more than about sqrt(2n) times fails every first-level attempt on its own and always
+    // lands in the largest bucket, which tells such an input from an unlucky one. The
+    // sizes are counted again into lens, a rejected attempt may have stopped early.
+    static void CheckLargestBucket(const HashFunction& hash, uint32_t cnt_buckets,
+                                   const Key* begin, const Key* end, std::vector<int>& lens) {
+        lens.assign(cnt_buckets, 0);
+        for (const Key* it = begin; it != end; ++it) {
+            ++lens[GetIndex(hash, *it, cnt_buckets)];
+        }
+        uint32_t largest = std::max_element(lens.begin(), lens.end()) - lens.begin();
+        CheckBucket(hash, cnt_buckets, largest, begin, end);
+    }
 
-    template<typename Predicate>
-    static LinearHashFunction GetHashFunction(int cnt_buckets,
-                                              const std::vector<int>& numbers,
-                                              Predicate predicat,
-                                              GenerateLinearHashFunction& generator) {
-        int count_run = 0;
+    // Draws hash functions until one spreads [begin, end) over cnt_buckets buckets with a
+    // sum of squared bucket sizes of at most max_square_sum: 2n on the first level, and n
+    // on the second, where it means that no two keys share a bucket. An attempt is
+    // abandoned as soon as the running sum passes the bound. If grow is set, cnt_buckets
+    // is widened by Relax, at most to kMaxGrowth * n buckets. lens is scratch space, it is
+    // reused by every attempt. count_run receives the number of hash functions drawn. When
+    // grow is set, every kRelaxEvery-th failed attempt also runs CheckLargestBucket.
+    static HashFunction GetHashFunction(uint32_t& cnt_buckets,
+                                        const Key* begin,
+                                        const Key* end,
+                                        int64_t max_square_sum,
+                                        bool grow,
+                                        Generator& generator,
+                                        std::vector<int>& lens,
+                                        int& count_run) {
+        count_run = 0;
         while (count_run < kMaxCountRun) {
             count_run++;
-            std::vector<int> lens(cnt_buckets, 0);
+            if (grow) {
+                Relax(count_run, end - begin, cnt_buckets);
+            }
+            lens.assign(cnt_buckets, 0);
             auto hash = generator.Generate();
-            for (int v: numbers) {
-                lens[hash.GetHash(v) % cnt_buckets] += 1;
+            int64_t square_sum = 0;
+            const Key* it = begin;
+            // (len + 1)^2 - len^2 = 2 len + 1.
+            for (; it != end && square_sum <= max_square_sum; ++it) {
+                int& len = lens[GetIndex(hash, *it, cnt_buckets)];
+                square_sum += 2 * len + 1;
+                ++len;
             }
-            if (predicat(lens)) {
+            if (square_sum <= max_square_sum) {
                 return hash;
             }
+            if (grow && (count_run - 1) % kRelaxEvery == 0) {
+                CheckLargestBucket(hash, cnt_buckets, begin, end, lens);
+            }
         }
         throw BadHashFunctionException("Bad hash function");
     }
 
-    static int SquereSum(const std::vector<int>& lens) {
-        int hu = 0;
-        for (int x: lens) {
-            hu += x * x;
+    void ComputeBuckets(const Key* keys, size_t count, uint32_t* buckets,
+                        bool vectorized) const noexcept {
+        size_t done = 0;
+#if FIXED_SET_HAS_AVX2_KERNEL
+        if constexpr (kVectorizable) {
+            if (vectorized) {
+                done = count & ~static_cast<size_t>(3);
+                linear_hash_simd::ComputeBucketsAvx2(
+                    keys, done, hash_->GetCoefficien(), hash_->GetBias(),
+                    GenerateLinearHashFunction::kPrime, buckets_.size(), buckets);
+            }
+        }
+#endif
+        for (size_t i = done; i < count; ++i) {
+            buckets[i] = GetIndex(*hash_, keys[i], buckets_.size());
         }
-        return hu;
     }
 
-    static std::vector<std::vector<int>> Split(
-        const std::vector<int>& numbers,
-        LinearHashFunction& hash,
-        int cnt_buckets) {
-        std::vector<std::vector<int>> buckets(cnt_buckets, std::vector<int>());
-        for (int v: numbers) {
-            int index = hash.GetHash(v) % cnt_buckets;
-            buckets[index].push_back(v);
+    void ComputeSlots(const Key* keys, size_t count, const uint32_t* buckets, uint32_t* slots,
+                      bool vectorized) const noexcept {
+        size_t done = 0;
+#if FIXED_SET_HAS_AVX2_KERNEL
+        if constexpr (kVectorizable) {
+            if (vectorized) {
+                done = count & ~static_cast<size_t>(3);
+                linear_hash_simd::ComputeSlotsAvx2(
+                    keys, done, buckets, reinterpret_cast<const int*>(buckets_.data()),
+                    sizeof(Bucket) / sizeof(int), GenerateLinearHashFunction::kPrime, slots);
+            }
+        }
+#endif
+        for (size_t i = 0; i < done; ++i) {
+            const Bucket& bucket = buckets_[buckets[i]];
+            if (bucket.size <= kScanSize) {
+                slots[i] = bucket.offset;
+            }
+        }
+        for (size_t i = done; i < count; ++i) {
+            slots[i] = GetFirstSlotIndex(buckets_[buckets[i]], keys[i]);
         }
-        return buckets;
     }
 
-    std::vector<InnerSet> InitBuckets(
-        const std::vector<std::vector<int>>& buckets, GenerateLinearHashFunction& generator) {
-        std::vector<InnerSet> data;
-        for (const auto& bucket: buckets) {
-            data.emplace_back();
-            data.back().Initialize(bucket, generator);
+    void CompareSlots(const Key* keys, size_t count, const uint32_t* slots, uint8_t* out,
+                      bool vectorized) const noexcept {
+        size_t done = 0;
+#if FIXED_SET_HAS_AVX2_KERNEL
+        if constexpr (kVectorizable) {
+            if (vectorized) {
+                done = count & ~static_cast<size_t>(3);
+                linear_hash_simd::CompareSlotsAvx2(keys, done, slots, slots_.data(), out);
+            }
+        }
+#endif
+        for (size_t i = done; i < count; ++i) {
+            out[i] = storage_.FromSlot(slots_[slots[i]]) == keys[i];
         }
-        return data;
     }
 
-public:
-    FixedSet() = default;
+    static size_t DivideRoundUp(size_t value, size_t divisor) {
+        return (value + divisor - 1) / divisor;
+    }
+
+    // The first-level search of GetHashFunction with the histogram of every attempt filled
+    // by cnt_threads threads through relaxed atomic counters. Draws the same functions from
+    // generator, grows the table the same way and accepts the same function as the serial
+    // search, and checks for a repeated key as often. Attempts are not abandoned early, the
+    // sum is only known once all threads are done.
+    static HashFunction GetHashFunctionParallel(const std::vector<Key>& numbers,
+                                                uint32_t& cnt_buckets,
+                                                Generator& generator,
+                                                int cnt_threads,
+                                                Arena& arena,
+                                                int& count_run) {
+        size_t cnt_key_tasks = DivideRoundUp(numbers.size(), kKeysPerTask);
+        count_run = 0;
+        while (count_run < kMaxCountRun) {
+            count_run++;
+            Relax(count_run, numbers.size(), cnt_buckets);
+            std::atomic<int>* lens = arena.GetCounters(cnt_buckets);
+            size_t cnt_bucket_tasks = DivideRoundUp(cnt_buckets, kBucketsPerTask);
+            auto hash = generator.Generate();
+            ParallelFor(cnt_threads, cnt_bucket_tasks, [&](size_t task) {
+                size_t end = std::min<size_t>((task + 1) * kBucketsPerTask, cnt_buckets);
+                for (size_t i = task * kBucketsPerTask; i < end; ++i) {
+                    lens[i].store(0, std::memory_order_relaxed);
+                }
+            });
+            ParallelFor(cnt_threads, cnt_key_tasks, [&](size_t task) {
+                size_t end = std::min((task + 1) * kKeysPerTask, numbers.size());
+                for (size_t i = task * kKeysPerTask; i < end; ++i) {
+                    lens[GetIndex(hash, numbers[i], cnt_buckets)].fetch_add(
+                        1, std::memory_order_relaxed);
+                }
+            });
+            std::atomic<int64_t> square_sum{0};
+            ParallelFor(cnt_threads, cnt_bucket_tasks, [&](size_t task) {
+                size_t end = std::min<size_t>((task + 1) * kBucketsPerTask, cnt_buckets);
+                int64_t local_sum = 0;
+                for (size_t i = task * kBucketsPerTask; i < end; ++i) {
+                    int64_t len = lens[i].load(std::memory_order_relaxed);
+                    local_sum += len * len;
+                }
+                square_sum.fetch_add(local_sum, std::memory_order_relaxed);
+            });
+            if (square_sum.load() <= 2 * static_cast<int64_t>(numbers.size())) {
+                return hash;
+            }
+            if ((count_run - 1) % kRelaxEvery == 0) {
+                CheckLargestBucket(hash, cnt_buckets, numbers.data(),
+                                   numbers.data() + numbers.size(), arena.lens_);
+            }
+        }
+        throw BadHashFunctionException("Bad hash function");
+    }
+
+    // Counting sort of numbers by first-level bucket into arena.scattered_: after the call
+    // bucket i occupies [starts[i], starts[i + 1]) of it, where starts is arena.starts_.
+    // With several threads the order of keys inside a bucket is unspecified, nothing
+    // downstream depends on it.
+    static void Split(
+        const std::vector<Key>& numbers,
+        const HashFunction& hash,
+        int cnt_buckets,
+        int cnt_threads,
+        Arena& arena) {
+        std::vector<int>& starts = arena.starts_;
+        std::vector<Key>& scattered = arena.scattered_;
+        starts.assign(cnt_buckets + 1, 0);
+        scattered.resize(numbers.size());
+        if (cnt_threads <= 1) {
+            for (const Key& v: numbers) {
+                starts[GetIndex(hash, v, cnt_buckets) + 1] += 1;
+            }
+            for (int i = 0; i < cnt_buckets; ++i) {
+                starts[i + 1] += starts[i];
+            }
+            std::vector<int>& positions = arena.positions_;
+            positions.assign(starts.begin(), starts.end() - 1);
+            for (const Key& v: numbers) {
+                scattered[positions[GetIndex(hash, v, cnt_buckets)]++] = v;
+            }
+            return;
+        }
 
-    void Initialize(const std::vector<int>& numbers) {
-        GenerateLinearHashFunction generator = GenerateLinearHashFunction();
+        std::atomic<int>* positions = arena.GetCounters(cnt_buckets);
+        for (int i = 0; i < cnt_buckets; ++i) {
+            positions[i].store(0, std::memory_order_relaxed);
+        }
+        size_t cnt_key_tasks = DivideRoundUp(numbers.size(), kKeysPerTask);
+        ParallelFor(cnt_threads, cnt_key_tasks, [&](size_t task) {
+            size_t end = std::min((task + 1) * kKeysPerTask, numbers.size());
+            for (size_t i = task * kKeysPerTask; i < end; ++i) {
+                positions[GetIndex(hash, numbers[i], cnt_buckets)].fetch_add(
+                    1, std::memory_order_relaxed);
+            }
+        });
+        for (int i = 0; i < cnt_buckets; ++i) {
+            starts[i + 1] = starts[i] + positions[i].load(std::memory_order_relaxed);
+            positions[i].store(starts[i], std::memory_order_relaxed);
+        }
+        ParallelFor(cnt_threads, cnt_key_tasks, [&](size_t task) {
+            size_t end = std::min((task + 1) * kKeysPerTask, numbers.size());
+            for (size_t i = task * kKeysPerTask; i < end; ++i) {
+                const Key& v = numbers[i];
+                int position = positions[GetIndex(hash, v, cnt_buckets)].fetch_add(
+                    1, std::memory_order_relaxed);
+                scattered[position] = v;
+            }
+        });
+    }
 
-        data_.clear();
+    // Fills the table of bucket, whose offset and size are set, with the keys [begin, end)
+    // and adds the hash functions it drew to attempts and max_attempts.
+    void InitBucket(Bucket& bucket, const Key* begin, const Key* end, Generator& generator,
+                    std::vector<int>& lens, std::vector<uint8_t>& used,
+                    size_t& attempts, int& max_attempts) {
+        if (bucket.size <= kScanSize) {
+            // Sorted so that the layout does not depend on the order of the keys.
+            static_assert(kScanSize == 2, "Buckets are scanned up to a pair");
+            const Key* low = begin;
+            if (bucket.size == 2) {
+                if (*begin == begin[1]) {
+                    throw DuplicateKeyException("Duplicate key");
+                }
+                low = begin[1] < *begin ? begin + 1 : begin;
+                slots_[bucket.offset + 1] = storage_.ToSlot(low == begin ? begin[1] : *begin);
+            }
+            slots_[bucket.offset] = storage_.ToSlot(*low);
+            return;
+        }
+        // Equal keys can never get distinct slots, so instead of exhausting every attempt,
+        // look for them. Quadratic in the bucket, but squared bucket sizes sum up to at
+        // most 2n.
+        for (const Key* it = begin + 1; it < end; ++it) {
+            if (std::find(begin, it, *it) != it) {
+                throw DuplicateKeyException("Duplicate key");
+            }
+        }
+        int count_run;
+        bucket.hash = GetHashFunction(
+            bucket.size, begin, end, end - begin, false, generator, lens, count_run);
+        attempts += count_run;
+        max_attempts = std::max(max_attempts, count_run);
+        used.assign(bucket.size, 0);
+        for (const Key* it = begin; it != end; ++it) {
+            uint32_t index = GetSlotIndex(bucket, *it);
+            slots_[index] = storage_.ToSlot(*it);
+            used[index - bucket.offset] = 1;
+        }
+        // Each key of the bucket hashes to its own slot, so it is a safe filler for every
+        // other slot of the bucket. Taking the one in the lowest slot keeps the layout
+        // independent of the order of keys inside the bucket.
+        Slot filler = slots_[bucket.offset + (std::find(used.begin(), used.end(), 1) -
+                                             used.begin())];
+        for (uint32_t j = 0; j < bucket.size; ++j) {
+            if (!used[j]) {
+                slots_[bucket.offset + j] = filler;
+            }
+        }
+    }
+
+    // Builds the second level of buckets [first, last) with its own generator.
+    void InitBucketRange(const std::vector<Key>& scattered, const std::vector<int>& starts,
+                         size_t first, size_t last, Generator& generator,
+                         std::vector<int>& lens, std::vector<uint8_t>& used,
+                         size_t& attempts, int& max_attempts) {
+        for (size_t i = first; i < last; ++i) {
+            if (starts[i + 1] != starts[i]) {
+                InitBucket(buckets_[i], scattered.data() + starts[i],
+                           scattered.data() + starts[i + 1], generator, lens, used,
+                           attempts, max_attempts);
+            }
+        }
+    }
+
+    // The buckets are cut into tasks of kBucketsPerTask, and task t draws its hash functions
+    // from a generator seeded with SplitMix64(seed + t). The result therefore depends on the
+    // seed only, not on the number of threads or on how tasks were scheduled.
+    void InitBuckets(Slot filler, uint64_t seed, int cnt_threads, Arena& arena) {
+        const std::vector<Key>& scattered = arena.scattered_;
+        const std::vector<int>& starts = arena.starts_;
+        int cnt_buckets = static_cast<int>(starts.size()) - 1;
+        // The shared slot of empty buckets goes first, any key will do as its filler.
+        buckets_.assign(cnt_buckets, Bucket{kSharedSlot, 1, *hash_});
+        std::vector<size_t>& histogram = stats_.bucket_size_histogram;
+        uint32_t total_size = kSharedSlot + 1;
+        for (int i = 0; i < cnt_buckets; ++i) {
+            uint32_t len = starts[i + 1] - starts[i];
+            if (len >= histogram.size()) {
+                histogram.resize(len + 1, 0);
+            }
+            ++histogram[len];
+            stats_.square_sum += len * len;
+            if (len > 0) {
+                uint32_t size = len <= kScanSize ? len : len * len;
+                buckets_[i].offset = total_size;
+                buckets_[i].size = size;
+                total_size += size;
+            }
+        }
+        slots_.assign(total_size, filler);
 
+        arena.Reserve(cnt_threads);
+        for (int worker = 0; worker < cnt_threads; ++worker) {
+            arena.GetWorker(worker).attempts = 0;
+            arena.GetWorker(worker).max_attempts = 0;
+        }
+        size_t cnt_tasks = DivideRoundUp(cnt_buckets, kBucketsPerTask);
+        ParallelForWithWorker(cnt_threads, cnt_tasks, [&](size_t task, int worker) {
+            Generator generator(SplitMix64(seed + task));
+            typename Arena::WorkerScratch& scratch = arena.GetWorker(worker);
+            InitBucketRange(scattered, starts, task * kBucketsPerTask,
+                            std::min<size_t>((task + 1) * kBucketsPerTask, cnt_buckets),
+                            generator, scratch.lens, scratch.used,
+                            scratch.attempts, scratch.max_attempts);
+        });
+        for (int worker = 0; worker < cnt_threads; ++worker) {
+            stats_.second_level_attempts += arena.GetWorker(worker).attempts;
+            stats_.max_bucket_attempts = std::max(stats_.max_bucket_attempts,
+                                                  arena.GetWorker(worker).max_attempts);
+        }
+    }
+
+    // Sorts a copy of numbers into arena.unique_ and drops repeated keys.
+    static const std::vector<Key>& RemoveDuplicates(const std::vector<Key>& numbers,
+                                                    Arena& arena) {
+        std::vector<Key>& unique = arena.unique_;
+        unique.assign(numbers.begin(), numbers.end());
+        if constexpr (std::is_integral_v<Key>) {
+            RadixSort(unique, arena.scattered_);
+        } else {
+            std::sort(unique.begin(), unique.end());
+        }
+        unique.erase(std::unique(unique.begin(), unique.end()), unique.end());
+        return unique;
+    }
+
+    // Builds the prefilter of numbers, redrawing its seed until the peeling succeeds.
+    void BuildFilter(const std::vector<Key>& numbers) {
+        Xoshiro256 generator(SplitMix64(~seed_ - cnt_updates_));
+        std::vector<uint64_t> hashes(numbers.size());
+        for (int attempt = 0; attempt < kMaxCountRun; ++attempt) {
+            uint64_t seed = generator();
+            for (size_t i = 0; i < numbers.size(); ++i) {
+                hashes[i] = GetFilterHash(numbers[i], seed);
+            }
+            if (filter_.Build(hashes, seed)) {
+                return;
+            }
+        }
+        filter_.Clear();
+        throw BadHashFunctionException("Cannot build the prefilter");
+    }
+
+    // Builds the set of input, with a prefilter if filtered.
+    void Build(const std::vector<Key>& input, int cnt_threads, uint64_t seed, Arena& arena,
+               bool filtered) {
+        buckets_.clear();
+        storage_.Clear();
+        slots_.clear();
+        occupied_.clear();
+        ranks_.clear();
+        filter_.Clear();
+        mapping_.reset();
+        cnt_garbage_slots_ = 0;
+        cnt_updates_ = 0;
+        seed_ = seed;
+        stats_ = BuildStats();
+        stats_.seed = seed;
+        stats_.max_attempts = kMaxCountRun;
+
+        using Clock = std::chrono::steady_clock;
+        auto elapsed = [](Clock::time_point start) {
+            return std::chrono::duration<double>(Clock::now() - start).count();
+        };
+        auto start = Clock::now();
+        const std::vector<Key>& distinct =
+            duplicate_keys_ == DuplicateKeys::kRemove ? RemoveDuplicates(input, arena) : input;
+        stats_.cnt_duplicates = input.size() - distinct.size();
+        const std::vector<Key>& numbers = storage_.Adopt(distinct);
         int cnt_number = numbers.size();
-        int cnt_buckets = cnt_number;
+        uint32_t cnt_buckets = cnt_number;
+        stats_.cnt_keys = cnt_number;
+        stats_.square_sum_bound = 2 * static_cast<uint64_t>(cnt_number);
         if (cnt_buckets == 0) {
+            stats_.scratch_memory_usage = arena.GetMemoryUsage();
             return;
         }
-        // X % 0 - is UB
-        hash_ = GetHashFunction(
-            cnt_buckets,
-            numbers,
-            [](const std::vector<int>& lens) {
-                return SquereSum(lens) <= static_cast<int>(2 * lens.size());
-            },
-            generator);
-        auto buckets = Split(
+        Generator generator(seed);
+        if (cnt_threads <= 1) {
+            hash_ = GetHashFunction(
+                cnt_buckets,
+                numbers.data(),
+                numbers.data() + numbers.size(),
+                stats_.square_sum_bound,
+                true,
+                generator,
+                arena.lens_,
+                stats_.first_level_attempts);
+        } else {
+            hash_ = GetHashFunctionParallel(numbers, cnt_buckets, generator, cnt_threads, arena,
+                                            stats_.first_level_attempts);
+        }
+        stats_.cnt_buckets = cnt_buckets;
+        stats_.first_level_seconds = elapsed(start);
+        start = Clock::now();
+        Split(
             numbers,
             hash_.value(),
-            cnt_buckets);
-        data_ = InitBuckets(buckets, generator);
+            cnt_buckets,
+            cnt_threads,
+            arena);
+        stats_.split_seconds = elapsed(start);
+        start = Clock::now();
+        InitBuckets(storage_.ToSlot(numbers.front()), seed, cnt_threads, arena);
+        if constexpr (kInlineSlots > 0) {
+            for (size_t i = 0; i < buckets_.size(); ++i) {
+                CopyInline(buckets_[i]);
+            }
+        }
+        stats_.second_level_seconds = elapsed(start);
+        start = Clock::now();
+        InitRanks();
+        stats_.rank_seconds = elapsed(start);
+        if (filtered) {
+            start = Clock::now();
+            BuildFilter(numbers);
+            stats_.filter_seconds = elapsed(start);
+        }
+        storage_.Release();
+        stats_.memory_usage = GetMemoryUsage();
+        stats_.scratch_memory_usage = arena.GetMemoryUsage();
+        stats_.bytes_per_key = GetBytesPerKey();
     }
 
-    bool Contains(int number) const {
-        if (data_.empty()) {
-            return false;
+    // One partition of an external build, see fixed_set_file_builder.h: builds the
+    // buckets [first_bucket, first_bucket + cnt_buckets) of a first level of cnt_total
+    // buckets under hash, from exactly their keys. first_bucket is a multiple of
+    // kBucketsPerTask, so the second level draws the hash functions Build would. The tables
+    // are local to the partition: buckets_[i] is bucket first_bucket + i, offsets count
+    // from the first slot of the partition, and slots_ is padded with filler to whole
+    // words of occupied_.
+    void BuildPartition(const std::vector<Key>& keys, const HashFunction& hash,
+                        uint32_t first_bucket, uint32_t cnt_buckets, uint32_t cnt_total,
+                        Slot filler, uint64_t seed, int cnt_threads) {
+        using Clock = std::chrono::steady_clock;
+        auto elapsed = [](Clock::time_point start) {
+            return std::chrono::duration<double>(Clock::now() - start).count();
+        };
+        auto start = Clock::now();
+        stats_ = BuildStats();
+        hash_ = hash;
+        std::vector<int>& starts = arena_.starts_;
+        std::vector<Key>& scattered = arena_.scattered_;
+        starts.assign(cnt_buckets + 1, 0);
+        scattered.resize(keys.size());
+        for (const Key& v: keys) {
+            starts[GetIndex(hash, v, cnt_total) - first_bucket + 1] += 1;
+        }
+        for (uint32_t i = 0; i < cnt_buckets; ++i) {
+            starts[i + 1] += starts[i];
+        }
+        std::vector<int>& positions = arena_.positions_;
+        positions.assign(starts.begin(), starts.end() - 1);
+        for (const Key& v: keys) {
+            scattered[positions[GetIndex(hash, v, cnt_total) - first_bucket]++] = v;
+        }
+        InitBuckets(filler, seed + first_bucket / kBucketsPerTask, cnt_threads, arena_);
+        size_t cnt_slots = slots_.size();
+        slots_.resize(DivideRoundUp(cnt_slots, 64) * 64);
+        for (size_t j = cnt_slots; j < slots_.size(); ++j) {
+            slots_[j] = filler;
         }
-        int cnt_buckets = data_.size();
-        int first = hash_.value().GetHash(number) % cnt_buckets;
-        return data_[first].Contains(number);
+        if constexpr (kInlineSlots > 0) {
+            for (size_t i = 0; i < buckets_.size(); ++i) {
+                CopyInline(buckets_[i]);
+            }
+        }
+        stats_.second_level_seconds = elapsed(start);
+        start = Clock::now();
+        InitRanks();
+        stats_.rank_seconds = elapsed(start);
+    }
+
+    // Sets the occupancy bits of the table of bucket.
+    void MarkOccupied(const Bucket& bucket) {
+        for (uint32_t j = bucket.offset; j < bucket.offset + bucket.size; ++j) {
+            if (GetSlotIndex(bucket, storage_.FromSlot(slots_[j])) == j) {
+                occupied_[j / 64] |= static_cast<uint64_t>(1) << (j % 64);
+            }
+        }
+    }
+
+    // A slot is occupied iff the key in it hashes to it, fillers always hash elsewhere.
+    // The shared slot of empty buckets is never occupied.
+    void InitRanks() {
+        size_t cnt_words = DivideRoundUp(slots_.size(), 64);
+        occupied_.assign(cnt_words, 0);
+        for (const Bucket& bucket: buckets_) {
+            if (bucket.offset != kSharedSlot) {
+                MarkOccupied(bucket);
+            }
+        }
+        CountRanks();
+    }
+
+    void CountRanks() {
+        size_t cnt_words = occupied_.size();
+        ranks_.assign(cnt_words, 0);
+        uint32_t rank = 0;
+        for (size_t w = 0; w < cnt_words; ++w) {
+            ranks_[w] = rank;
+            rank += __builtin_popcountll(occupied_[w]);
+        }
+    }
+
+    template <class T, class Allocator>
+    static std::string_view AsBytes(const Table<T, Allocator>& table) noexcept {
+        return std::string_view(reinterpret_cast<const char*>(table.data()),
+                                table.size() * sizeof(T));
+    }
+
+    static FixedSetFileHeader MakeHeader() noexcept {
+        FixedSetFileHeader header{};
+        std::memcpy(header.magic, FixedSetFileHeader::kMagic, sizeof(header.magic));
+        header.version = FixedSetFileHeader::kVersion;
+        header.byte_order = FixedSetFileHeader::kByteOrderMark;
+        header.key_tag = Storage::kFormatTag;
+        header.policy_tag = HashPolicy::kFormatTag;
+        header.bucket_size = sizeof(Bucket);
+        header.slot_size = sizeof(Slot);
+        return header;
+    }
+
+    uint32_t GetRank(uint32_t index) const noexcept {
+        uint64_t below = occupied_[index / 64] & ((static_cast<uint64_t>(1) << (index % 64)) - 1);
+        return ranks_[index / 64] + __builtin_popcountll(below);
+    }
+
+    bool IsOccupied(uint32_t index) const noexcept {
+        return (occupied_[index / 64] >> (index % 64)) & 1;
+    }
+
+    // Number of keys in bucket, recovered from the size of its table.
+    static uint32_t GetBucketLength(const Bucket& bucket) noexcept {
+        if (bucket.offset == kSharedSlot) {
+            return 0;
+        }
+        if (bucket.size <= kScanSize) {
+            return bucket.size;
+        }
+        return static_cast<uint32_t>(std::lround(std::sqrt(static_cast<double>(bucket.size))));
+    }
+
+    static void SortUnique(std::vector<Key>& keys) {
+        std::sort(keys.begin(), keys.end());
+        keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    }
+
+    // Rebuilds the set from scratch with the seed of the last build: the keys it holds
+    // without erase, plus insert. erase must be sorted. The new tables are built aside
+    // and only then replace the current ones, so if the build throws the set is unchanged.
+    void Rebuild(const std::vector<Key>& erase, const std::vector<Key>& insert) {
+        std::vector<Key> keys;
+        keys.reserve(Size() - erase.size() + insert.size());
+        for (uint32_t j = 0; j < slots_.size(); ++j) {
+            Key key = storage_.FromSlot(slots_[j]);
+            if (IsOccupied(j) && !std::binary_search(erase.begin(), erase.end(), key)) {
+                keys.push_back(key);
+            }
+        }
+        keys.insert(keys.end(), insert.begin(), insert.end());
+        BasicFixedSet rebuilt;
+        rebuilt.duplicate_keys_ = duplicate_keys_;
+        rebuilt.Build(keys, 1, seed_, arena_, prefilter_ || !filter_.Empty());
+        // String keys point into the old blob and, for a loaded set, into the mapped file,
+        // both stay alive until here.
+        hash_ = rebuilt.hash_;
+        buckets_ = std::move(rebuilt.buckets_);
+        storage_ = std::move(rebuilt.storage_);
+        slots_ = std::move(rebuilt.slots_);
+        occupied_ = std::move(rebuilt.occupied_);
+        ranks_ = std::move(rebuilt.ranks_);
+        mapping_.reset();
+        seed_ = rebuilt.seed_;
+        stats_ = std::move(rebuilt.stats_);
+        cnt_garbage_slots_ = 0;
+        cnt_updates_ = 0;
+        filter_ = std::move(rebuilt.filter_);
+    }
+
+    // Turns a set read by LoadFrom into one that owns its tables, and recovers the
+    // statistics Update relies on.
+    void DetachFromFile() {
+        buckets_.Detach();
+        slots_.Detach();
+        occupied_.Detach();
+        ranks_.Detach();
+        filter_.Detach();
+        storage_.Detach();
+        mapping_.reset();
+        stats_.square_sum_bound = 2 * static_cast<uint64_t>(Size());
+        for (const Bucket& bucket: buckets_) {
+            uint32_t len = GetBucketLength(bucket);
+            if (len >= stats_.bucket_size_histogram.size()) {
+                stats_.bucket_size_histogram.resize(len + 1, 0);
+            }
+            ++stats_.bucket_size_histogram[len];
+            stats_.square_sum += static_cast<uint64_t>(len) * len;
+        }
+    }
+
+    // Replaces the table of bucket by one holding keys: in place when it fits, at the end
+    // of slots_ otherwise.
+    void RelocateBucket(Bucket& bucket, const std::vector<Key>& keys, Generator& generator,
+                        typename Arena::WorkerScratch& scratch) {
+        bool placed = bucket.offset != kSharedSlot;
+        uint32_t old_size = placed ? bucket.size : 0;
+        for (uint32_t j = bucket.offset; placed && j < bucket.offset + bucket.size; ++j) {
+            occupied_[j / 64] &= ~(static_cast<uint64_t>(1) << (j % 64));
+        }
+        uint32_t len = keys.size();
+        uint32_t size = len <= kScanSize ? len : len * len;
+        if (len == 0) {
+            bucket = Bucket{kSharedSlot, 1, *hash_};
+            cnt_garbage_slots_ += old_size;
+            return;
+        }
+        if (placed && size <= old_size) {
+            cnt_garbage_slots_ += old_size - size;
+        } else {
+            cnt_garbage_slots_ += old_size;
+            bucket.offset = slots_.size();
+            slots_.resize(slots_.size() + size);
+            occupied_.resize(DivideRoundUp(slots_.size(), 64));
+        }
+        bucket.size = size;
+        bucket.hash = *hash_;
+        InitBucket(bucket, keys.data(), keys.data() + len, generator, scratch.lens,
+                   scratch.used, scratch.attempts, scratch.max_attempts);
+        MarkOccupied(bucket);
+    }
+
+    // A group of up to kBatchSize keys of ContainsBatch on its way through the stages.
+    // keys are the ones looked up in the tables: the group itself, or without the keys
+    // the prefilter rejected, which are then copied to candidates.
+    struct BatchGroup {
+        const Key* keys;
+        size_t start;
+        size_t count;
+        size_t cnt_candidates;
+        bool sampled;
+        uint64_t started;
+        uint64_t hashes[kBatchSize];
+        Key candidates[kBatchSize];
+        uint32_t order[kBatchSize];
+        uint32_t buckets[kBatchSize];
+        uint32_t slots[kBatchSize];
+        // The first slot to compare with, in the record for buckets with inline slots.
+        const Slot* probes[kBatchSize];
+    };
+
+    // First stage: takes keys[start, start + count) and prefetches their filter cells.
+    void StartGroup(const Key* keys, size_t start, size_t count,
+                    BatchGroup& group) const noexcept {
+        group.keys = keys + start;
+        group.start = start;
+        group.count = count;
+        group.cnt_candidates = count;
+        group.sampled = false;
+        if constexpr (Instrumented) {
+            group.sampled = LookupStats::ShouldSample(lookup_stats_.Local());
+            group.started = group.sampled ? ReadCycles() : 0;
+        }
+        if (!filter_.Empty()) {
+            for (size_t i = 0; i < count; ++i) {
+                group.hashes[i] = GetFilterHash(group.keys[i], filter_.GetSeed());
+                filter_.Prefetch(group.hashes[i]);
+            }
+        }
+    }
+
+    // Second stage: drops the keys the prefilter rejects, hashes the rest to buckets and
+    // prefetches their records.
+    void PrefetchBuckets(BatchGroup& group, bool vectorized) const noexcept {
+        if (!filter_.Empty()) {
+            size_t cnt_candidates = 0;
+            for (size_t i = 0; i < group.count; ++i) {
+                group.candidates[cnt_candidates] = group.keys[i];
+                group.order[cnt_candidates] = i;
+                cnt_candidates += filter_.Contains(group.hashes[i]);
+            }
+            group.keys = group.candidates;
+            group.cnt_candidates = cnt_candidates;
+        }
+        ComputeBuckets(group.keys, group.cnt_candidates, group.buckets, vectorized);
+        for (size_t i = 0; i < group.cnt_candidates; ++i) {
+            __builtin_prefetch(&buckets_[group.buckets[i]]);
+        }
+    }
+
+    // Third stage: reads the records, finds the slots and prefetches the ones that are not
+    // copied into their record.
+    void PrefetchSlots(BatchGroup& group, bool vectorized) const noexcept {
+        ComputeSlots(group.keys, group.cnt_candidates, group.buckets, group.slots, vectorized);
+        for (size_t i = 0; i < group.cnt_candidates; ++i) {
+            if constexpr (kInlineSlots > 0) {
+                const Bucket& bucket = buckets_[group.buckets[i]];
+                group.probes[i] = GetTable(bucket) + (group.slots[i] - bucket.offset);
+                if (bucket.size <= kInlineSlots) {
+                    continue;
+                }
+            }
+            __builtin_prefetch(&slots_[group.slots[i]]);
+        }
+    }
+
+    // Last stage: compares the slots and writes the answers to out[start, start + count).
+    void FinishGroup(const BatchGroup& group, uint8_t* out, bool vectorized) const noexcept {
+        uint8_t* answers = out + group.start;
+        size_t count = group.cnt_candidates;
+        std::fill(answers + count, answers + group.count, 0);
+        if constexpr (kInlineSlots > 0) {
+            // CompareSlots gathers by index from slots_, probes also point into records.
+            for (size_t i = 0; i < count; ++i) {
+                answers[i] = storage_.FromSlot(*group.probes[i]) == group.keys[i];
+                if (!answers[i] && buckets_[group.buckets[i]].size == kScanSize) {
+                    answers[i] = storage_.FromSlot(group.probes[i][1]) == group.keys[i];
+                }
+            }
+        } else {
+            CompareSlots(group.keys, count, group.slots, answers, vectorized);
+            for (size_t i = 0; i < count; ++i) {
+                if (!answers[i] && buckets_[group.buckets[i]].size == kScanSize) {
+                    answers[i] = storage_.FromSlot(slots_[group.slots[i] + 1]) == group.keys[i];
+                }
+            }
+        }
+        if (!filter_.Empty()) {
+            // Answers land in the front of the group's output and move to their keys from
+            // the back, order[i] >= i never overwrites one still to be moved.
+            for (size_t i = count; i-- > 0;) {
+                uint8_t answer = answers[i];
+                answers[i] = 0;
+                answers[group.order[i]] = answer;
+            }
+        }
+        if constexpr (Instrumented) {
+            LookupStats::Counters& counters = lookup_stats_.Local();
+            for (size_t i = 0; i < count; ++i) {
+                CountBucket(counters, buckets_[group.buckets[i]]);
+            }
+            if (group.sampled) {
+                LookupStats::RecordLatency(counters, (ReadCycles() - group.started) / group.count);
+            }
+            LookupStats::Add(counters.lookups, group.count);
+            LookupStats::Add(counters.filtered, group.count - count);
+            LookupStats::Add(counters.hits, std::count(answers, answers + group.count, 1));
+        }
+    }
+
+public:
+    BasicFixedSet() = default;
+
+    void Initialize(const std::vector<Key>& numbers) {
+        Initialize(numbers, 1);
+    }
+
+    // Builds the set on cnt_threads threads, the calling one included.
+    void Initialize(const std::vector<Key>& numbers, int cnt_threads) {
+        Initialize(numbers, cnt_threads, arena_);
+    }
+
+    // Same as above with scratch memory taken from arena instead of the set's own one.
+    void Initialize(const std::vector<Key>& numbers, int cnt_threads, Arena& arena) {
+        Initialize(numbers, cnt_threads, Xoshiro256::DrawSeed(), arena);
+    }
+
+    // Builds the set with every random choice derived from seed: equal keys and seeds give
+    // the same tables whatever cnt_threads is. The thread count comes first so that
+    // Initialize(numbers, 4) keeps meaning four threads.
+    void Initialize(const std::vector<Key>& numbers, int cnt_threads, uint64_t seed) {
+        Initialize(numbers, cnt_threads, seed, arena_);
+    }
+
+    void Initialize(const std::vector<Key>& numbers, int cnt_threads, uint64_t seed,
+                    Arena& arena) {
+        Build(numbers, cnt_threads, seed, arena, prefilter_);
+    }
+
+    // Applies to every following Initialize and Update.
+    void SetDuplicateKeys(DuplicateKeys duplicate_keys) noexcept {
+        duplicate_keys_ = duplicate_keys;
+    }
+
+    // Adds a binary fuse filter of about 9 bits per key in front of the tables, built by
+    // every following Initialize. An Update that adds keys rebuilds it, which is a pass
+    // over all keys. With it a lookup first reads three
+    // bytes of the filter, which is small enough to stay in cache, and only a probable hit,
+    // that is a key of the set or about 1 in 256 others, goes on to the two dependent
+    // reads of the tables. It pays off when most queries are misses, and costs a hash and
+    // the filter probe on every hit.
+    void SetPrefilter(bool enabled) noexcept {
+        prefilter_ = enabled;
+    }
+
+    // Removes the keys of removed and then inserts the keys of added. Removing an absent
+    // key does nothing, adding a present one or the same one twice is an error unless
+    // duplicates are removed. Such errors are found before anything changes, and a full
+    // rebuild is done aside, so when either throws the set is left unchanged. An allocation
+    // failure while single buckets are rebuilt in place only gives the basic guarantee:
+    // the set can still be destroyed or initialized again.
+    //
+    // The first-level hash is kept as long as the sum of squared bucket sizes stays within
+    // the bound of a fresh build, and only the buckets the keys fall into are rebuilt, so a
+    // small delta costs little more than its own size plus a pass over the rank directory,
+    // which is 1/64 of the slots. Grown tables move to the end of the slots and leave
+    // garbage behind. Once the bound is broken or garbage takes up half of the slots, the
+    // whole set is rebuilt with the seed of the last build. Indices given by IndexOf are
+    // reassigned. Must not run concurrently with lookups.
+    void Update(const std::vector<Key>& added, const std::vector<Key>& removed) {
+        std::vector<Key> erase;
+        for (const Key& key: removed) {
+            if (ContainsUncounted(key)) {
+                erase.push_back(key);
+            }
+        }
+        SortUnique(erase);
+        std::vector<Key> insert;
+        for (const Key& key: added) {
+            if (!ContainsUncounted(key) ||
+                std::binary_search(erase.begin(), erase.end(), key)) {
+                insert.push_back(key);
+            } else if (duplicate_keys_ == DuplicateKeys::kReject) {
+                throw DuplicateKeyException("Duplicate key");
+            }
+        }
+        size_t cnt_inserted = insert.size();
+        SortUnique(insert);
+        if (insert.size() != cnt_inserted && duplicate_keys_ == DuplicateKeys::kReject) {
+            throw DuplicateKeyException("Duplicate key");
+        }
+        // A key removed and added again stays where it is.
+        std::vector<Key> kept;
+        std::set_intersection(erase.begin(), erase.end(), insert.begin(), insert.end(),
+                              std::back_inserter(kept));
+        auto drop_kept = [&kept](std::vector<Key>& keys) {
+            keys.erase(std::remove_if(keys.begin(), keys.end(), [&kept](const Key& key) {
+                return std::binary_search(kept.begin(), kept.end(), key);
+            }), keys.end());
+        };
+        drop_kept(erase);
+        drop_kept(insert);
+        if (erase.empty() && insert.empty()) {
+            return;
+        }
+        size_t cnt_keys = Size() - erase.size() + insert.size();
+        if (slots_.empty() || cnt_keys == 0) {
+            Rebuild(erase, insert);
+            return;
+        }
+        if (mapping_) {
+            DetachFromFile();
+        }
+
+        // Buckets the delta falls into, with the new keys of each.
+        std::vector<std::pair<uint32_t, uint32_t>> changes;
+        for (const Key& key: erase) {
+            changes.emplace_back(GetIndex(*hash_, key, buckets_.size()), UINT32_MAX);
+        }
+        for (uint32_t i = 0; i < insert.size(); ++i) {
+            changes.emplace_back(GetIndex(*hash_, insert[i], buckets_.size()), i);
+        }
+        std::sort(changes.begin(), changes.end());
+        int64_t square_sum = stats_.square_sum;
+        for (size_t i = 0; i < changes.size();) {
+            size_t next = i;
+            int64_t len = GetBucketLength(buckets_[changes[i].first]);
+            int64_t new_len = len;
+            for (; next < changes.size() && changes[next].first == changes[i].first; ++next) {
+                new_len += changes[next].second == UINT32_MAX ? -1 : 1;
+            }
+            square_sum += new_len * new_len - len * len;
+            i = next;
+        }
+        if (square_sum > 2 * static_cast<int64_t>(cnt_keys)) {
+            Rebuild(erase, insert);
+            return;
+        }
+
+        bool shared_erased = std::binary_search(erase.begin(), erase.end(),
+                                                storage_.FromSlot(slots_[kSharedSlot]));
+        const std::vector<Key>& inserted = storage_.Append(insert);
+        Generator generator(SplitMix64(seed_ - ++cnt_updates_));
+        arena_.Reserve(1);
+        typename Arena::WorkerScratch& scratch = arena_.GetWorker(0);
+        scratch.attempts = 0;
+        scratch.max_attempts = 0;
+        std::vector<Key>& keys = arena_.unique_;
+        std::vector<size_t>& histogram = stats_.bucket_size_histogram;
+        for (size_t i = 0; i < changes.size();) {
+            uint32_t index = changes[i].first;
+            Bucket& bucket = buckets_[index];
+            keys.clear();
+            for (uint32_t j = bucket.offset; j < bucket.offset + bucket.size; ++j) {
+                Key key = storage_.FromSlot(slots_[j]);
+                if (IsOccupied(j) && !std::binary_search(erase.begin(), erase.end(), key)) {
+                    keys.push_back(key);
+                }
+            }
+            uint32_t len = GetBucketLength(bucket);
+            for (; i < changes.size() && changes[i].first == index; ++i) {
+                if (changes[i].second != UINT32_MAX) {
+                    keys.push_back(inserted[changes[i].second]);
+                }
+            }
+            --histogram[len];
+            if (keys.size() >= histogram.size()) {
+                histogram.resize(keys.size() + 1, 0);
+            }
+            ++histogram[keys.size()];
+            RelocateBucket(bucket, keys, generator, scratch);
+        }
+        storage_.Release();
+        if (shared_erased) {
+            uint32_t word = 0;
+            while (occupied_[word] == 0) {
+                ++word;
+            }
+            slots_[kSharedSlot] = slots_[word * 64 + __builtin_ctzll(occupied_[word])];
+        }
+        // After the shared slot got its new key: an emptied bucket must not copy a removed
+        // key that hashes to it. Empty buckets left untouched keep a copy of the old key,
+        // which never hashes to them.
+        if constexpr (kInlineSlots > 0) {
+            for (const auto& change: changes) {
+                CopyInline(buckets_[change.first]);
+            }
+        }
+        CountRanks();
+        // Removed keys may stay in the filter, they only become false positives, but added
+        // ones must be in it.
+        if ((prefilter_ || !filter_.Empty()) && !insert.empty()) {
+            std::vector<Key>& numbers = arena_.unique_;
+            numbers.clear();
+            for (uint32_t j = 0; j < slots_.size(); ++j) {
+                if (IsOccupied(j)) {
+                    numbers.push_back(storage_.FromSlot(slots_[j]));
+                }
+            }
+            BuildFilter(numbers);
+        }
+
+        stats_.cnt_keys = cnt_keys;
+        stats_.square_sum = square_sum;
+        stats_.square_sum_bound = 2 * static_cast<uint64_t>(cnt_keys);
+        stats_.second_level_attempts += scratch.attempts;
+        stats_.max_bucket_attempts = std::max(stats_.max_bucket_attempts, scratch.max_attempts);
+        stats_.memory_usage = GetMemoryUsage();
+        stats_.scratch_memory_usage = arena_.GetMemoryUsage();
+        stats_.bytes_per_key = GetBytesPerKey();
+        if (cnt_garbage_slots_ * 2 > slots_.size()) {
+            Rebuild({}, {});
+        }
+    }
+
+    // Seed of the build that produced the set, passing it back to Initialize rebuilds it.
+    uint64_t GetSeed() const noexcept {
+        return seed_;
+    }
+
+    // Statistics of the last Initialize. A set read by LoadFrom only knows its seed, its
+    // size and its memory usage.
+    const BuildStats& GetBuildStats() const noexcept {
+        return stats_;
+    }
+
+    // Writes the set to path, see FixedSetFileHeader for the layout. The file is replaced
+    // as a whole, see ReplaceFile, so sets loaded from path, this one included, keep
+    // answering from the file they mapped.
+    void SaveTo(const std::string& path) const {
+        static_assert(std::is_trivially_copyable_v<Bucket> && std::is_trivially_copyable_v<Slot>,
+                      "Saved tables are raw memory");
+        using Header = FixedSetFileHeader;
+        std::string_view sections[Header::kCntSections] = {
+            hash_ ? std::string_view(reinterpret_cast<const char*>(&*hash_), sizeof(HashFunction))
+                  : std::string_view(),
+            AsBytes(buckets_), AsBytes(slots_), AsBytes(occupied_), AsBytes(ranks_),
+            storage_.GetBlob(),
+            filter_.Empty() ? std::string_view()
+                            : std::string_view(reinterpret_cast<const char*>(&filter_.GetParams()),
+                                               sizeof(BinaryFuseFilter::Params)),
+            AsBytes(filter_.GetFingerprints())};
+
+        Header header = MakeHeader();
+        header.seed = seed_;
+        FixedSetChecksum checksum;
+        uint64_t offset = DivideRoundUp(sizeof(Header), Header::kAlignment) * Header::kAlignment;
+        for (int i = 0; i < Header::kCntSections; ++i) {
+            header.section_offsets[i] = offset;
+            header.section_sizes[i] = sections[i].size();
+            offset += DivideRoundUp(sections[i].size(), Header::kAlignment) * Header::kAlignment;
+            checksum.Update(sections[i].data(), sections[i].size());
+        }
+        header.file_size = offset;
+        header.checksum = checksum.Get();
+
+        std::string temp = MakeTempPath(path);
+        std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+        const char padding[Header::kAlignment] = {};
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        uint64_t written = sizeof(header);
+        for (int i = 0; i < Header::kCntSections; ++i) {
+            out.write(padding, header.section_offsets[i] - written);
+            out.write(sections[i].data(), sections[i].size());
+            written = header.section_offsets[i] + sections[i].size();
+        }
+        out.write(padding, header.file_size - written);
+        out.close();
+        if (!out) {
+            std::remove(temp.c_str());
+            throw std::runtime_error("Cannot write " + path);
+        }
+        ReplaceFile(temp, path);
+    }
+
+    // Replaces the set with the one saved at path. The tables are not copied: the set looks
+    // keys up in a read-only mapping of the file, which it keeps until the next Initialize
+    // or LoadFrom. Checking the checksum reads the whole file once; skipping it makes
+    // loading take constant time, and pages are then only read when lookups touch them.
+    void LoadFrom(const std::string& path, bool verify_checksum = true) {
+        using Header = FixedSetFileHeader;
+        auto mapping = std::make_shared<const MappedFile>(path);
+        auto fail = [&path](const std::string& reason) {
+            throw std::runtime_error("Cannot load " + path + ": " + reason);
+        };
+        Header header;
+        if (mapping->Size() < sizeof(Header)) {
+            fail("file is too short");
+        }
+        std::memcpy(&header, mapping->Data(), sizeof(Header));
+        if (std::memcmp(header.magic, Header::kMagic, sizeof(header.magic)) != 0) {
+            fail("not a FixedSet file");
+        }
+        if (header.byte_order != Header::kByteOrderMark) {
+            fail("written on a machine of the other byte order");
+        }
+        if (header.version != Header::kVersion) {
+            fail("unsupported version " + std::to_string(header.version));
+        }
+        Header expected = MakeHeader();
+        if (header.key_tag != expected.key_tag || header.policy_tag != expected.policy_tag ||
+            header.bucket_size != expected.bucket_size ||
+            header.slot_size != expected.slot_size) {
+            fail("written by a set of another key type or hash policy");
+        }
+        if (header.file_size != mapping->Size()) {
+            fail("file is truncated");
+        }
+
+        const size_t element_sizes[Header::kCntSections] = {
+            sizeof(HashFunction), sizeof(Bucket), sizeof(Slot), sizeof(uint64_t),
+            sizeof(uint32_t), 1, sizeof(BinaryFuseFilter::Params), 1};
+        size_t counts[Header::kCntSections];
+        for (int i = 0; i < Header::kCntSections; ++i) {
+            uint64_t offset = header.section_offsets[i];
+            uint64_t size = header.section_sizes[i];
+            if (offset % Header::kAlignment != 0 || offset < sizeof(Header) ||
+                offset > header.file_size || size > header.file_size - offset ||
+                size % element_sizes[i] != 0) {
+                fail("bad section table");
+            }
+            counts[i] = size / element_sizes[i];
+        }
+        bool empty = counts[Header::kSlots] == 0;
+        if (counts[Header::kHash] != (empty ? 0 : 1) ||
+            (counts[Header::kBuckets] == 0) != empty ||
+            counts[Header::kOccupied] != DivideRoundUp(counts[Header::kSlots], 64) ||
+            counts[Header::kRanks] != counts[Header::kOccupied] ||
+            counts[Header::kFilterParams] > (empty ? 0 : 1) ||
+            (counts[Header::kFilter] == 0) != (counts[Header::kFilterParams] == 0)) {
+            fail("inconsistent table sizes");
+        }
+        auto section = [&](int i) {
+            return mapping->Data() + header.section_offsets[i];
+        };
+        if (verify_checksum) {
+            FixedSetChecksum checksum;
+            for (int i = 0; i < Header::kCntSections; ++i) {
+                checksum.Update(section(i), header.section_sizes[i]);
+            }
+            if (checksum.Get() != header.checksum) {
+                fail("checksum mismatch");
+            }
+        }
+
+        BinaryFuseFilter filter;
+        if (counts[Header::kFilterParams] == 1) {
+            BinaryFuseFilter::Params params;
+            std::memcpy(&params, section(Header::kFilterParams), sizeof(params));
+            if (!filter.View(params, reinterpret_cast<const uint8_t*>(section(Header::kFilter)),
+                             counts[Header::kFilter])) {
+                fail("bad prefilter");
+            }
+        }
+
+        hash_.reset();
+        if (!empty) {
+            HashFunction hash = *reinterpret_cast<const HashFunction*>(section(Header::kHash));
+            hash_ = hash;
+        }
+        buckets_.View(reinterpret_cast<const Bucket*>(section(Header::kBuckets)),
+                      counts[Header::kBuckets]);
+        slots_.View(reinterpret_cast<const Slot*>(section(Header::kSlots)),
+                    counts[Header::kSlots]);
+        occupied_.View(reinterpret_cast<const uint64_t*>(section(Header::kOccupied)),
+                       counts[Header::kOccupied]);
+        ranks_.View(reinterpret_cast<const uint32_t*>(section(Header::kRanks)),
+                    counts[Header::kRanks]);
+        storage_.ViewBlob(section(Header::kBlob), counts[Header::kBlob]);
+        filter_ = std::move(filter);
+        mapping_ = std::move(mapping);
+        cnt_garbage_slots_ = 0;
+        cnt_updates_ = 0;
+        seed_ = header.seed;
+        stats_ = BuildStats();
+        stats_.seed = seed_;
+        stats_.cnt_keys = Size();
+        stats_.cnt_buckets = buckets_.size();
+        stats_.memory_usage = GetMemoryUsage();
+        stats_.bytes_per_key = GetBytesPerKey();
+    }
+
+    // Number of keys in the set.
+    size_t Size() const noexcept {
+        return ranks_.empty() ? 0 : ranks_[ranks_.size() - 1] +
+                                    __builtin_popcountll(occupied_[occupied_.size() - 1]);
+    }
+
+    // Bytes held by the lookup tables, scratch memory of the build is not included.
+    size_t GetMemoryUsage() const noexcept {
+        return buckets_.capacity() * sizeof(Bucket) + slots_.capacity() * sizeof(Slot) +
+               storage_.GetMemoryUsage() + occupied_.capacity() * sizeof(uint64_t) +
+               ranks_.capacity() * sizeof(uint32_t) + filter_.GetMemoryUsage();
+    }
+
+    double GetBytesPerKey() const noexcept {
+        return Size() == 0 ? 0.0 : static_cast<double>(GetMemoryUsage()) / Size();
+    }
+
+    bool Contains(const Key& number) const noexcept {
+        if constexpr (Instrumented) {
+            return FindCounted(number).has_value();
+        }
+        return ContainsUncounted(number);
+    }
+
+    // Returns a dense index in [0, Size()) of number if it is in the set: distinct keys get
+    // distinct indices, so payloads can be kept in a plain array next to the set.
+    std::optional<uint32_t> IndexOf(const Key& number) const noexcept {
+        if constexpr (Instrumented) {
+            std::optional<uint32_t> slot = FindCounted(number);
+            return slot ? std::optional<uint32_t>(GetRank(*slot)) : std::nullopt;
+        }
+        if (slots_.empty() || !MayContain(number)) {
+            return std::nullopt;
+        }
+        const Bucket& bucket = GetBucket(number);
+        const Slot* table = GetTable(bucket);
+        uint32_t position = GetPosition(bucket, table, number);
+        if (storage_.FromSlot(table[position]) != number) {
+            return std::nullopt;
+        }
+        return GetRank(bucket.offset + position);
+    }
+
+    // Answers Contains for keys[0..n) into out[0..n). Keys are processed in groups of
+    // kBatchSize that move through the stages StartGroup, PrefetchBuckets, PrefetchSlots
+    // and FinishGroup, each stage kPrefetchDistance groups behind the one before it, so a
+    // prefetched record or slot is only read once the lookups of kPrefetchDistance other
+    // groups have run, and the misses of many groups are in flight at once. With the linear
+    // policy hashing uses the AVX2 kernel from linear_hash_simd.h when the CPU supports it.
+    // With a prefilter only the probable hits of a group go through the tables.
+    void ContainsBatch(const Key* keys, size_t n, uint8_t* out) const noexcept {
+        if (slots_.empty()) {
+            std::fill(out, out + n, 0);
+            if constexpr (Instrumented) {
+                LookupStats::Add(lookup_stats_.Local().lookups, n);
+            }
+            return;
+        }
+        bool vectorized = kVectorizable && linear_hash_simd::HasAvx2() &&
+                          buckets_.size() < kMaxVectorizedBuckets;
+        constexpr size_t kDistance = kPrefetchDistance;
+        constexpr size_t kCntInFlight = 3 * kDistance + 1;
+        BatchGroup groups[kCntInFlight];
+        size_t cnt_groups = DivideRoundUp(n, kBatchSize);
+        for (size_t step = 0; step < cnt_groups + 3 * kDistance; ++step) {
+            if (step >= 3 * kDistance) {
+                FinishGroup(groups[(step - 3 * kDistance) % kCntInFlight], out, vectorized);
+            }
+            if (step >= 2 * kDistance && step - 2 * kDistance < cnt_groups) {
+                PrefetchSlots(groups[(step - 2 * kDistance) % kCntInFlight], vectorized);
+            }
+            if (step >= kDistance && step - kDistance < cnt_groups) {
+                PrefetchBuckets(groups[(step - kDistance) % kCntInFlight], vectorized);
+            }
+            if (step < cnt_groups) {
+                size_t start = step * kBatchSize;
+                StartGroup(keys, start, std::min(kBatchSize, n - start),
+                           groups[step % kCntInFlight]);
+            }
+        }
+    }
+
+    // Lookups counted so far by all threads, only for an Instrumented set. A snapshot taken
+    // while other threads look keys up may miss their latest lookups.
+    LookupStatsSnapshot GetLookupStats() const noexcept {
+        static_assert(Instrumented, "Lookups are only counted by an Instrumented set");
+        return lookup_stats_.Snapshot();
+    }
+
+    // Must not run concurrently with lookups.
+    void ResetLookupStats() noexcept {
+        static_assert(Instrumented, "Lookups are only counted by an Instrumented set");
+        lookup_stats_.Reset();
     }
 };
+
+using FixedSet = BasicFixedSet<>;
+using InstrumentedFixedSet = BasicFixedSet<int, LinearHashPolicy, StandardAllocation, true>;
+using CoLocatedFixedSet = BasicFixedSet<int, LinearHashPolicy, AlignedAllocation<64>>;
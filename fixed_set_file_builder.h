@@ -0,0 +1,518 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <istream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "fixed_set.h"
+
+// Sources of keys for BasicFixedSetFileBuilder: Read stores up to capacity keys and
+// returns how many, 0 once there are none left.
+
+// The keys of [first, last).
+template <class Iterator>
+class KeyRangeSource {
+    Iterator current_;
+    Iterator last_;
+
+public:
+    KeyRangeSource(Iterator first, Iterator last) : current_(first), last_(last) {
+    }
+
+    template <class Key>
+    size_t Read(Key* keys, size_t capacity) {
+        size_t count = 0;
+        for (; count < capacity && current_ != last_; ++count, ++current_) {
+            keys[count] = *current_;
+        }
+        return count;
+    }
+};
+
+// Keys stored as raw memory in a binary stream, e.g. a file written from a std::vector.
+template <class Key>
+class KeyStreamSource {
+    std::istream& in_;
+
+public:
+    explicit KeyStreamSource(std::istream& in) : in_(in) {
+    }
+
+    size_t Read(Key* keys, size_t capacity) {
+        in_.read(reinterpret_cast<char*>(keys), capacity * sizeof(Key));
+        size_t bytes = in_.gcount();
+        if (bytes % sizeof(Key) != 0) {
+            throw std::runtime_error("Key stream ends inside a key");
+        }
+        return bytes / sizeof(Key);
+    }
+};
+
+// Builds a set straight into the file its SaveTo would write, in memory bounded by
+// memory_limit however many keys there are. The file is read back with LoadFrom of a set
+// of the same key type and policies.
+//
+// The keys are streamed once from the source into a spill file. Every attempt of the
+// first-level search radix-partitions the spill by first-level bucket into a second file,
+// one region per partition, and reads the partitions back one at a time to add up the
+// squared bucket sizes. A partition is a run of whole build tasks, sized so that it and
+// its tables take about half the limit. Once a hash function is accepted, the section
+// sizes are known, and every partition builds its second level on its own and writes its
+// part of each section in place. Hash functions are drawn as Initialize with the same
+// seed draws them, so lookups, IndexOf and the build statistics agree with an in-memory
+// build. Only the slot table differs: every partition starts with a spare slot and is
+// padded to whole 64-slot words. There is no prefilter, it needs every hash at once.
+//
+// With DuplicateKeys::kRemove, the spill is first rewritten without repeated keys, by
+// partitioning it by key and deduplicating every partition. Scratch files are kept next
+// to the output, with the suffixes .keys, .unique and .parts.
+template <class Key = int, class HashPolicy = typename DefaultHashPolicy<Key>::Type,
+          class AllocationPolicy = StandardAllocation>
+class BasicFixedSetFileBuilder {
+public:
+    using Set = BasicFixedSet<Key, HashPolicy, AllocationPolicy>;
+    static constexpr size_t kDefaultMemoryLimit = static_cast<size_t>(256) << 20;
+
+private:
+    static_assert(!std::is_same_v<Key, std::string_view>, "String keys live in memory");
+
+    using HashFunction = typename HashPolicy::HashFunction;
+    using Generator = typename HashPolicy::Generator;
+    using Bucket = typename Set::Bucket;
+    using Slot = typename Set::Slot;
+    using Header = FixedSetFileHeader;
+
+    // Build memory per key of a partition: the key and its scattered copy, a record, up
+    // to two slots, the start, position and length of a bucket, and the rank directory.
+    static constexpr size_t kPartitionBytesPerKey =
+        2 * sizeof(Key) + sizeof(Bucket) + 2 * sizeof(Slot) + 3 * sizeof(int) + 1;
+    static constexpr size_t kMinBufferKeys = 256;
+    // A multiple of 8, so that the checksum reads each section as if in one piece.
+    static constexpr size_t kChecksumChunk = 1 << 20;
+
+    // A scratch file, removed when it goes out of scope.
+    class ScratchFile {
+        std::string path_;
+
+    public:
+        explicit ScratchFile(std::string path) : path_(std::move(path)) {
+        }
+
+        ScratchFile(const ScratchFile&) = delete;
+        ScratchFile& operator=(const ScratchFile&) = delete;
+
+        ~ScratchFile() {
+            std::remove(path_.c_str());
+        }
+
+        const std::string& GetPath() const noexcept {
+            return path_;
+        }
+    };
+
+    size_t memory_limit_;
+    DuplicateKeys duplicate_keys_ = DuplicateKeys::kReject;
+    BuildStats stats_;
+    size_t cnt_partitions_ = 0;
+    std::vector<Key> chunk_;
+    std::vector<Key> keys_;
+
+    // Raises the peak scratch memory to usage plus the chunk and partition buffers.
+    void Remember(size_t usage) noexcept {
+        usage += (chunk_.capacity() + keys_.capacity()) * sizeof(Key);
+        stats_.scratch_memory_usage = std::max(stats_.scratch_memory_usage, usage);
+    }
+
+    size_t ChoosePartitionCount(uint64_t cnt_keys) const noexcept {
+        return std::max<size_t>(
+            1, Set::DivideRoundUp(cnt_keys * kPartitionBytesPerKey, memory_limit_ / 2));
+    }
+
+    static void WriteAt(std::ofstream& out, uint64_t offset, std::string_view bytes) {
+        out.seekp(offset);
+        out.write(bytes.data(), bytes.size());
+    }
+
+    // Calls visit on every key of the file at path, a chunk at a time.
+    template <class Visit>
+    void ForEachKey(const std::string& path, Visit visit) {
+        std::ifstream in(path, std::ios::binary);
+        if (!in) {
+            throw std::runtime_error("Cannot read " + path);
+        }
+        KeyStreamSource<Key> source(in);
+        while (size_t count = source.Read(chunk_.data(), chunk_.size())) {
+            for (size_t i = 0; i < count; ++i) {
+                visit(chunk_[i]);
+            }
+        }
+    }
+
+    // Copies the keys of source to path and returns their number.
+    template <class Source>
+    uint64_t Spill(Source& source, const std::string& path) {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        uint64_t cnt_keys = 0;
+        while (size_t count = source.Read(chunk_.data(), chunk_.size())) {
+            out.write(reinterpret_cast<const char*>(chunk_.data()), count * sizeof(Key));
+            cnt_keys += count;
+        }
+        out.flush();
+        if (!out) {
+            throw std::runtime_error("Cannot write " + path);
+        }
+        return cnt_keys;
+    }
+
+    // Radix-partitions the keys at from into to: counts the keys of every partition, then
+    // writes each partition's keys into its region through a buffer of its own. Returns
+    // where the regions start, in keys, with the end of the last one appended.
+    template <class GetPartition>
+    std::vector<uint64_t> Scatter(const std::string& from, const std::string& to,
+                                  size_t cnt_partitions, GetPartition get_partition) {
+        std::vector<Key>().swap(keys_);
+        std::vector<uint64_t> starts(cnt_partitions + 1, 0);
+        ForEachKey(from, [&](const Key& key) {
+            ++starts[get_partition(key) + 1];
+        });
+        for (size_t p = 0; p < cnt_partitions; ++p) {
+            starts[p + 1] += starts[p];
+        }
+
+        size_t buffer_keys =
+            std::max(kMinBufferKeys, memory_limit_ / 4 / sizeof(Key) / cnt_partitions);
+        std::vector<Key> buffers(cnt_partitions * buffer_keys);
+        std::vector<size_t> filled(cnt_partitions, 0);
+        std::vector<uint64_t> written(starts.begin(), starts.end() - 1);
+        std::ofstream out(to, std::ios::binary | std::ios::trunc);
+        auto flush = [&](size_t p) {
+            const Key* buffer = buffers.data() + p * buffer_keys;
+            WriteAt(out, written[p] * sizeof(Key),
+                    std::string_view(reinterpret_cast<const char*>(buffer),
+                                     filled[p] * sizeof(Key)));
+            written[p] += filled[p];
+            filled[p] = 0;
+        };
+        ForEachKey(from, [&](const Key& key) {
+            size_t p = get_partition(key);
+            buffers[p * buffer_keys + filled[p]++] = key;
+            if (filled[p] == buffer_keys) {
+                flush(p);
+            }
+        });
+        for (size_t p = 0; p < cnt_partitions; ++p) {
+            flush(p);
+        }
+        out.flush();
+        if (!out) {
+            throw std::runtime_error("Cannot write " + to);
+        }
+        Remember(buffers.capacity() * sizeof(Key) +
+                 (starts.capacity() + written.capacity()) * sizeof(uint64_t) +
+                 filled.capacity() * sizeof(size_t));
+        return starts;
+    }
+
+    // Loads partition p of a file written by Scatter into keys_.
+    void ReadPartition(std::ifstream& in, const std::vector<uint64_t>& starts, size_t p) {
+        keys_.resize(starts[p + 1] - starts[p]);
+        in.seekg(starts[p] * sizeof(Key));
+        in.read(reinterpret_cast<char*>(keys_.data()), keys_.size() * sizeof(Key));
+        if (!in) {
+            throw std::runtime_error("Cannot read a partition of the keys");
+        }
+    }
+
+    // Writes the distinct keys at from into to, returns their number and the smallest of
+    // them in min_key.
+    uint64_t RemoveDuplicates(const std::string& from, uint64_t cnt_keys,
+                              const std::string& to, Key& min_key) {
+        ScratchFile parts(to + ".parts");
+        size_t cnt_partitions = ChoosePartitionCount(cnt_keys);
+        std::vector<uint64_t> starts =
+            Scatter(from, parts.GetPath(), cnt_partitions, [cnt_partitions](const Key& key) {
+                uint64_t mixed = SplitMix64(static_cast<uint64_t>(key));
+                return static_cast<size_t>(((mixed >> 32) * cnt_partitions) >> 32);
+            });
+        std::ifstream in(parts.GetPath(), std::ios::binary);
+        std::ofstream out(to, std::ios::binary | std::ios::trunc);
+        uint64_t cnt_unique = 0;
+        for (size_t p = 0; p < cnt_partitions; ++p) {
+            ReadPartition(in, starts, p);
+            std::sort(keys_.begin(), keys_.end());
+            keys_.erase(std::unique(keys_.begin(), keys_.end()), keys_.end());
+            if (!keys_.empty() && (cnt_unique == 0 || keys_.front() < min_key)) {
+                min_key = keys_.front();
+            }
+            out.write(reinterpret_cast<const char*>(keys_.data()), keys_.size() * sizeof(Key));
+            cnt_unique += keys_.size();
+        }
+        out.flush();
+        if (!out) {
+            throw std::runtime_error("Cannot write " + to);
+        }
+        Remember(0);
+        return cnt_unique;
+    }
+
+    // The first bucket of partition p of cnt_partitions over cnt_buckets buckets. Bucket
+    // b belongs to partition task * cnt_partitions / cnt_tasks, where task is its build
+    // task, so a partition is a run of whole tasks.
+    static uint32_t GetFirstBucket(size_t p, size_t cnt_partitions, uint32_t cnt_buckets) {
+        size_t cnt_tasks = Set::DivideRoundUp(cnt_buckets, Set::kBucketsPerTask);
+        size_t task = Set::DivideRoundUp(p * cnt_tasks, cnt_partitions);
+        return std::min<size_t>(task * Set::kBucketsPerTask, cnt_buckets);
+    }
+
+    // Adds up the squared bucket sizes of the partitions at path under hash. Returns
+    // false as soon as the sum passes the bound, otherwise fills the slot count of every
+    // partition, padded to whole words. In kReject mode a rejected partition is checked for
+    // a repeated key, the builder has no other way to see one before the second level.
+    bool CheckPartitions(const std::string& path, const std::vector<uint64_t>& starts,
+                         const HashFunction& hash, uint32_t cnt_buckets,
+                         std::vector<uint32_t>& cnt_slots) {
+        size_t cnt_partitions = starts.size() - 1;
+        std::ifstream in(path, std::ios::binary);
+        std::vector<uint32_t> lens;
+        uint64_t square_sum = 0;
+        cnt_slots.assign(cnt_partitions, 0);
+        for (size_t p = 0; p < cnt_partitions; ++p) {
+            ReadPartition(in, starts, p);
+            uint32_t first = GetFirstBucket(p, cnt_partitions, cnt_buckets);
+            lens.assign(GetFirstBucket(p + 1, cnt_partitions, cnt_buckets) - first, 0);
+            for (const Key& key: keys_) {
+                ++lens[Set::GetIndex(hash, key, cnt_buckets) - first];
+            }
+            uint64_t size = Set::kSharedSlot + 1;
+            for (uint32_t len: lens) {
+                square_sum += static_cast<uint64_t>(len) * len;
+                size += len <= Set::kScanSize ? len : static_cast<uint64_t>(len) * len;
+            }
+            if (square_sum > stats_.square_sum_bound) {
+                if (duplicate_keys_ == DuplicateKeys::kReject) {
+                    // A repeated key is in the partition that pushed the sum over.
+                    uint32_t largest = std::max_element(lens.begin(), lens.end()) - lens.begin();
+                    Set::CheckBucket(hash, cnt_buckets, first + largest, keys_.data(),
+                                     keys_.data() + keys_.size());
+                }
+                return false;
+            }
+            cnt_slots[p] = Set::DivideRoundUp(size, 64) * 64;
+            Remember(lens.capacity() * sizeof(uint32_t));
+        }
+        stats_.square_sum = square_sum;
+        return true;
+    }
+
+    template <class Source>
+    void BuildFile(Source& source, const std::string& path, int cnt_threads, uint64_t seed) {
+        using Clock = std::chrono::steady_clock;
+        auto elapsed = [](Clock::time_point start) {
+            return std::chrono::duration<double>(Clock::now() - start).count();
+        };
+        stats_ = BuildStats();
+        stats_.seed = seed;
+        stats_.max_attempts = Set::kMaxCountRun;
+        cnt_partitions_ = 0;
+        chunk_.resize(std::max(kMinBufferKeys, memory_limit_ / 4 / sizeof(Key)));
+
+        auto start = Clock::now();
+        ScratchFile spill(path + ".keys");
+        uint64_t cnt_input = Spill(source, spill.GetPath());
+        Key filler{};
+        ScratchFile unique(path + ".unique");
+        const std::string* keys_path = &spill.GetPath();
+        uint64_t cnt_keys = cnt_input;
+        if (cnt_input > 0 && duplicate_keys_ == DuplicateKeys::kRemove) {
+            cnt_keys = RemoveDuplicates(spill.GetPath(), cnt_input, unique.GetPath(), filler);
+            keys_path = &unique.GetPath();
+        } else if (cnt_input > 0) {
+            std::ifstream in(spill.GetPath(), std::ios::binary);
+            KeyStreamSource<Key>(in).Read(&filler, 1);
+        }
+        stats_.cnt_keys = cnt_keys;
+        stats_.cnt_duplicates = cnt_input - cnt_keys;
+        stats_.square_sum_bound = 2 * cnt_keys;
+        stats_.split_seconds = elapsed(start);
+        if (cnt_keys == 0) {
+            Set set;
+            set.Initialize({}, 1, seed);
+            set.SaveTo(path);
+            return;
+        }
+
+        // The first-level search of Set::GetHashFunction, an attempt per partitioning.
+        start = Clock::now();
+        ScratchFile parts(path + ".parts");
+        Generator generator(seed);
+        uint32_t cnt_buckets = cnt_keys;
+        std::optional<HashFunction> hash;
+        std::vector<uint64_t> starts;
+        std::vector<uint32_t> cnt_slots;
+        for (int count_run = 1; !hash; ++count_run) {
+            if (count_run > Set::kMaxCountRun) {
+                throw BadHashFunctionException("Bad hash function");
+            }
+            Set::Relax(count_run, cnt_keys, cnt_buckets);
+            HashFunction candidate = generator.Generate();
+            size_t cnt_tasks = Set::DivideRoundUp(cnt_buckets, Set::kBucketsPerTask);
+            cnt_partitions_ = std::min(ChoosePartitionCount(cnt_keys), cnt_tasks);
+            starts = Scatter(*keys_path, parts.GetPath(), cnt_partitions_, [&](const Key& key) {
+                size_t task = Set::GetIndex(candidate, key, cnt_buckets) / Set::kBucketsPerTask;
+                return task * cnt_partitions_ / cnt_tasks;
+            });
+            if (CheckPartitions(parts.GetPath(), starts, candidate, cnt_buckets, cnt_slots)) {
+                hash = candidate;
+            }
+            stats_.first_level_attempts = count_run;
+        }
+        stats_.cnt_buckets = cnt_buckets;
+        stats_.first_level_seconds = elapsed(start);
+
+        uint64_t cnt_total_slots = 0;
+        for (uint32_t count: cnt_slots) {
+            cnt_total_slots += count;
+        }
+        uint64_t cnt_words = cnt_total_slots / 64;
+        uint64_t sizes[Header::kCntSections] = {
+            sizeof(HashFunction), cnt_buckets * sizeof(Bucket), cnt_total_slots * sizeof(Slot),
+            cnt_words * sizeof(uint64_t), cnt_words * sizeof(uint32_t), 0, 0, 0};
+        Header header = Set::MakeHeader();
+        header.seed = seed;
+        uint64_t offset = Set::DivideRoundUp(sizeof(Header), Header::kAlignment) *
+                          Header::kAlignment;
+        for (int i = 0; i < Header::kCntSections; ++i) {
+            header.section_offsets[i] = offset;
+            header.section_sizes[i] = sizes[i];
+            offset += Set::DivideRoundUp(sizes[i], Header::kAlignment) * Header::kAlignment;
+        }
+        header.file_size = offset;
+
+        ScratchFile output(MakeTempPath(path));
+        std::ofstream out(output.GetPath(), std::ios::binary | std::ios::trunc);
+        WriteAt(out, header.section_offsets[Header::kHash],
+                std::string_view(reinterpret_cast<const char*>(&*hash), sizeof(HashFunction)));
+        std::ifstream in(parts.GetPath(), std::ios::binary);
+        Set part;
+        uint64_t slot_base = 0;
+        uint32_t rank_base = 0;
+        for (size_t p = 0; p < cnt_partitions_; ++p) {
+            ReadPartition(in, starts, p);
+            uint32_t first = GetFirstBucket(p, cnt_partitions_, cnt_buckets);
+            uint32_t last = GetFirstBucket(p + 1, cnt_partitions_, cnt_buckets);
+            part.BuildPartition(keys_, *hash, first, last - first, cnt_buckets,
+                                part.storage_.ToSlot(filler), seed, cnt_threads);
+            uint32_t cnt_part_keys = part.Size();
+            for (size_t i = 0; i < part.buckets_.size(); ++i) {
+                if (part.buckets_[i].offset != Set::kSharedSlot) {
+                    part.buckets_[i].offset += slot_base;
+                }
+            }
+            for (size_t w = 0; w < part.ranks_.size(); ++w) {
+                part.ranks_[w] += rank_base;
+            }
+            WriteAt(out, header.section_offsets[Header::kBuckets] + first * sizeof(Bucket),
+                    Set::AsBytes(part.buckets_));
+            WriteAt(out, header.section_offsets[Header::kSlots] + slot_base * sizeof(Slot),
+                    Set::AsBytes(part.slots_));
+            WriteAt(out, header.section_offsets[Header::kOccupied] + slot_base / 8,
+                    Set::AsBytes(part.occupied_));
+            WriteAt(out, header.section_offsets[Header::kRanks] + slot_base / 16,
+                    Set::AsBytes(part.ranks_));
+            slot_base += part.slots_.size();
+            rank_base += cnt_part_keys;
+
+            const BuildStats& part_stats = part.stats_;
+            stats_.second_level_attempts += part_stats.second_level_attempts;
+            stats_.max_bucket_attempts = std::max(stats_.max_bucket_attempts,
+                                                  part_stats.max_bucket_attempts);
+            std::vector<size_t>& histogram = stats_.bucket_size_histogram;
+            if (histogram.size() < part_stats.bucket_size_histogram.size()) {
+                histogram.resize(part_stats.bucket_size_histogram.size(), 0);
+            }
+            for (size_t len = 0; len < part_stats.bucket_size_histogram.size(); ++len) {
+                histogram[len] += part_stats.bucket_size_histogram[len];
+            }
+            stats_.second_level_seconds += part_stats.second_level_seconds;
+            stats_.rank_seconds += part_stats.rank_seconds;
+            Remember(part.arena_.GetMemoryUsage() + part.GetMemoryUsage());
+        }
+        if (slot_base != cnt_total_slots || rank_base != cnt_keys) {
+            throw std::logic_error("Partitions do not match their slot counts");
+        }
+        uint64_t end = header.section_offsets[Header::kRanks] + sizes[Header::kRanks];
+        const char padding[Header::kAlignment] = {};
+        WriteAt(out, end, std::string_view(padding, header.file_size - end));
+        out.flush();
+
+        FixedSetChecksum checksum;
+        std::ifstream written(output.GetPath(), std::ios::binary);
+        std::vector<char> buffer(kChecksumChunk);
+        for (int i = 0; i < Header::kCntSections; ++i) {
+            written.seekg(header.section_offsets[i]);
+            for (uint64_t left = header.section_sizes[i]; left > 0;) {
+                size_t size = std::min<uint64_t>(left, buffer.size());
+                written.read(buffer.data(), size);
+                checksum.Update(buffer.data(), size);
+                left -= size;
+            }
+        }
+        header.checksum = checksum.Get();
+        WriteAt(out, 0, std::string_view(reinterpret_cast<const char*>(&header), sizeof(header)));
+        out.close();
+        if (!out || !written) {
+            throw std::runtime_error("Cannot write " + path);
+        }
+        ReplaceFile(output.GetPath(), path);
+        stats_.memory_usage = sizes[Header::kBuckets] + sizes[Header::kSlots] +
+                              sizes[Header::kOccupied] + sizes[Header::kRanks];
+        stats_.bytes_per_key = static_cast<double>(stats_.memory_usage) / cnt_keys;
+    }
+
+public:
+    explicit BasicFixedSetFileBuilder(size_t memory_limit = kDefaultMemoryLimit)
+        : memory_limit_(memory_limit) {
+    }
+
+    void SetDuplicateKeys(DuplicateKeys duplicate_keys) noexcept {
+        duplicate_keys_ = duplicate_keys;
+    }
+
+    // Reads source until it runs dry and writes the set of its keys to path, building
+    // the second level on cnt_threads threads. The file is written beside path and only
+    // renamed over it once complete, see ReplaceFile, so if the build fails path is left
+    // as it was, and sets loaded from it keep working either way.
+    template <class Source>
+    void Build(Source& source, const std::string& path, int cnt_threads = 1) {
+        Build(source, path, cnt_threads, Xoshiro256::DrawSeed());
+    }
+
+    template <class Source>
+    void Build(Source& source, const std::string& path, int cnt_threads, uint64_t seed) {
+        BuildFile(source, path, cnt_threads, seed);
+    }
+
+    // What the last Build did. memory_usage is the size of the written tables and
+    // scratch_memory_usage the peak of the memory the build held beyond the source.
+    const BuildStats& GetBuildStats() const noexcept {
+        return stats_;
+    }
+
+    // Partitions of the accepted first-level hash function.
+    size_t GetPartitionCount() const noexcept {
+        return cnt_partitions_;
+    }
+};
+
+using FixedSetFileBuilder = BasicFixedSetFileBuilder<>;
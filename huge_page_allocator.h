@@ -0,0 +1,142 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <new>
+
+#include <sys/mman.h>
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+// Allocator for large lookup tables that backs them with huge pages, so random probes
+// over gigabytes of tables miss the TLB far less often: one 2 MB entry covers what 512
+// ordinary ones do. Blocks whose 2 MB rounded size is a multiple of 1 GB first try
+// reserved 1 GB pages, rounding up to them could waste most of a gigabyte. Blocks of at
+// least 2 MB try reserved 2 MB pages (MAP_HUGETLB, see /proc/sys/vm/nr_hugepages). Without
+// reserved pages it falls back to a 2 MB aligned mapping marked MADV_HUGEPAGE, which
+// transparent huge pages back whenever the kernel allows it. Smaller blocks come from
+// the heap. Every block is at least kAlignment aligned.
+template <class T>
+class HugePageAllocator {
+public:
+    using value_type = T;
+    static constexpr size_t kHugePage = static_cast<size_t>(2) << 20;
+    static constexpr size_t kGiantPage = static_cast<size_t>(1) << 30;
+    static constexpr size_t kAlignment = 64;
+
+private:
+    static size_t RoundUp(size_t value, size_t multiple) noexcept {
+        return (value + multiple - 1) / multiple * multiple;
+    }
+
+    // Takes reserved pages of 2^page_shift bytes.
+    static void* MapReserved(size_t size, int page_shift) noexcept {
+        int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (page_shift << MAP_HUGE_SHIFT);
+        void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+        return data == MAP_FAILED ? nullptr : data;
+    }
+
+    // Maps size bytes at a kHugePage aligned address: maps one huge page more than needed
+    // and unmaps the parts before and after the aligned range.
+    static void* MapTransparent(size_t size) noexcept {
+        void* data = mmap(nullptr, size + kHugePage, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (data == MAP_FAILED) {
+            return nullptr;
+        }
+        uintptr_t start = reinterpret_cast<uintptr_t>(data);
+        uintptr_t aligned = RoundUp(start, kHugePage);
+        if (aligned > start) {
+            munmap(data, aligned - start);
+        }
+        munmap(reinterpret_cast<void*>(aligned + size), start + kHugePage - aligned);
+        madvise(reinterpret_cast<void*>(aligned), size, MADV_HUGEPAGE);
+        return reinterpret_cast<void*>(aligned);
+    }
+
+    // Length of the mapping behind a block of bytes, 0 for heap blocks. Reserved 1 GB
+    // pages are only taken for blocks that fill them exactly, so 2 MB granularity
+    // describes every mapping.
+    static size_t GetMappedSize(size_t bytes) noexcept {
+        return bytes < kHugePage ? 0 : RoundUp(bytes, kHugePage);
+    }
+
+public:
+    HugePageAllocator() = default;
+
+    template <class U>
+    HugePageAllocator(const HugePageAllocator<U>&) noexcept {
+    }
+
+    T* allocate(size_t n) {
+        size_t bytes = n * sizeof(T);
+        size_t size = GetMappedSize(bytes);
+        void* data = nullptr;
+        if (size == 0) {
+            size_t length = RoundUp(std::max<size_t>(bytes, 1), kAlignment);
+            data = std::aligned_alloc(kAlignment, length);
+        } else {
+            if (size % kGiantPage == 0) {
+                data = MapReserved(size, 30);
+            }
+            if (!data) {
+                data = MapReserved(size, 21);
+            }
+            if (!data) {
+                data = MapTransparent(size);
+            }
+        }
+        if (!data) {
+            throw std::bad_alloc();
+        }
+        return static_cast<T*>(data);
+    }
+
+    void deallocate(T* data, size_t n) noexcept {
+        size_t size = GetMappedSize(n * sizeof(T));
+        if (size == 0) {
+            std::free(data);
+        } else {
+            munmap(data, size);
+        }
+    }
+
+    template <class U>
+    bool operator==(const HugePageAllocator<U>&) const noexcept {
+        return true;
+    }
+
+    template <class U>
+    bool operator!=(const HugePageAllocator<U>&) const noexcept {
+        return false;
+    }
+};
+
+// Allocation policies of BasicFixedSet: the allocator of its flat tables and the
+// alignment of its first-level records. Records aligned to a cache line never straddle
+// two lines, at the price of padding them to 64 bytes, which BasicFixedSet fills with a
+// copy of small second-level tables.
+struct StandardAllocation {
+    template <class T>
+    using Allocator = std::allocator<T>;
+    static constexpr size_t kRecordAlignment = 1;
+};
+
+template <size_t RecordAlignment = 64>
+struct AlignedAllocation {
+    template <class T>
+    using Allocator = std::allocator<T>;
+    static constexpr size_t kRecordAlignment = RecordAlignment;
+};
+
+template <size_t RecordAlignment = 1>
+struct HugePageAllocation {
+    template <class T>
+    using Allocator = HugePageAllocator<T>;
+    static constexpr size_t kRecordAlignment = RecordAlignment;
+};
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+#include "random_generator.h"
+
+// Hash families for FixedSet keys wider than int. Like the int families in fixed_set.h,
+// every function maps a key to 32 bits and is drawn at random by a generator, so FixedSet
+// can redraw it until a bucket is collision free.
+
+// Multiply-add-shift over 128-bit arithmetic: the top 32 bits of a * x + b modulo 2^128.
+// Strongly universal for 64-bit keys and only a few multiply instructions.
+class MultiplyShift64HashFunction {
+    __uint128_t coefficien_;
+    __uint128_t bias_;
+
+public:
+    MultiplyShift64HashFunction(__uint128_t coefficien, __uint128_t bias) :
+    coefficien_(coefficien), bias_(bias) {
+    }
+
+    uint32_t GetHash(uint64_t value) const noexcept {
+        return (coefficien_ * value + bias_) >> 96;
+    }
+};
+
+class GenerateMultiplyShift64HashFunction {
+    Xoshiro256 generator_;
+
+    __uint128_t Draw() {
+        return (static_cast<__uint128_t>(generator_()) << 64) | generator_();
+    }
+
+public:
+    GenerateMultiplyShift64HashFunction() = default;
+
+    explicit GenerateMultiplyShift64HashFunction(uint64_t seed) : generator_(seed) {
+    }
+
+    MultiplyShift64HashFunction Generate() {
+        __uint128_t coefficien = Draw();
+        return MultiplyShift64HashFunction(coefficien, Draw());
+    }
+};
+
+// Seeded string hash in the spirit of wyhash: eight bytes at a time are folded into the
+// state with a 64x64->128 multiply whose halves are xored together.
+class StringHashFunction {
+    uint64_t seed_;
+    uint64_t secret_;
+    static const uint64_t kMix = 0xa0761d6478bd642f;
+
+    static uint64_t Fold(uint64_t lhs, uint64_t rhs) noexcept {
+        __uint128_t product = static_cast<__uint128_t>(lhs) * rhs;
+        return static_cast<uint64_t>(product) ^ static_cast<uint64_t>(product >> 64);
+    }
+
+public:
+    StringHashFunction(uint64_t seed, uint64_t secret) : seed_(seed), secret_(secret) {
+    }
+
+    uint32_t GetHash(std::string_view value) const noexcept {
+        return GetHash64(value) >> 32;
+    }
+
+    // All 64 bits of the final fold, for users that need a wider hash than FixedSet does.
+    uint64_t GetHash64(std::string_view value) const noexcept {
+        const char* data = value.data();
+        size_t size = value.size();
+        uint64_t state = seed_;
+        while (size > 8) {
+            uint64_t word;
+            std::memcpy(&word, data, sizeof(word));
+            state = Fold(word ^ secret_, state ^ kMix);
+            data += 8;
+            size -= 8;
+        }
+        uint64_t tail = 0;
+        std::memcpy(&tail, data, size);
+        state = Fold(tail ^ secret_, state ^ kMix ^ value.size());
+        return Fold(state, secret_ ^ kMix);
+    }
+};
+
+class GenerateStringHashFunction {
+    Xoshiro256 generator_;
+
+public:
+    GenerateStringHashFunction() = default;
+
+    explicit GenerateStringHashFunction(uint64_t seed) : generator_(seed) {
+    }
+
+    StringHashFunction Generate() {
+        uint64_t seed = generator_();
+        return StringHashFunction(seed, generator_() | 1);
+    }
+};
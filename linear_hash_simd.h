@@ -0,0 +1,137 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Vector counterparts of LinearHashFunction::GetHash followed by "% cnt_buckets", and of
+// the final slot comparison.
+// Both reductions are done without integer division: the quotient is estimated in double
+// precision, the remainder is recomputed exactly in integers and corrected by one step,
+// so the results are bit-identical to the scalar code.
+//
+// Only an AVX2 kernel is provided. It is compiled with a target attribute and chosen at
+// run time, so the rest of the binary does not require AVX2.
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FIXED_SET_HAS_AVX2_KERNEL 1
+#include <immintrin.h>
+#else
+#define FIXED_SET_HAS_AVX2_KERNEL 0
+#endif
+
+namespace linear_hash_simd {
+
+inline bool HasAvx2() {
+#if FIXED_SET_HAS_AVX2_KERNEL
+    static const bool kHasAvx2 = __builtin_cpu_supports("avx2");
+    return kHasAvx2;
+#else
+    return false;
+#endif
+}
+
+#if FIXED_SET_HAS_AVX2_KERNEL
+
+// Brings every lane of value from [-modulo, 2 * modulo) to [0, modulo).
+__attribute__((target("avx2"))) inline __m128i Normalize(__m128i value, __m128i modulo) {
+    __m128i negative = _mm_cmpgt_epi32(_mm_setzero_si128(), value);
+    value = _mm_add_epi32(value, _mm_and_si128(negative, modulo));
+    __m128i less = _mm_cmpgt_epi32(modulo, value);
+    return _mm_sub_epi32(value, _mm_andnot_si128(less, modulo));
+}
+
+// (value * coefficien + bias) mod prime for four lanes, 0 <= coefficien, bias < prime < 2^30.
+__attribute__((target("avx2"))) inline __m128i HashLanes(__m128i value, __m128i coefficien,
+                                                        __m128i bias, int prime) {
+    __m256d product = _mm256_mul_pd(_mm256_cvtepi32_pd(value), _mm256_cvtepi32_pd(coefficien));
+    __m256d quotient = _mm256_floor_pd(_mm256_mul_pd(product, _mm256_set1_pd(1.0 / prime)));
+    __m256i exact = _mm256_mul_epi32(_mm256_cvtepi32_epi64(value),
+                                     _mm256_cvtepi32_epi64(coefficien));
+    __m256i multiple = _mm256_mul_epi32(_mm256_cvtepi32_epi64(_mm256_cvttpd_epi32(quotient)),
+                                        _mm256_set1_epi64x(prime));
+    __m256i wide = _mm256_sub_epi64(exact, multiple);
+    __m128i remainder = _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(
+        wide, _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6)));
+    __m128i modulo = _mm_set1_epi32(prime);
+    remainder = Normalize(remainder, modulo);
+    return Normalize(_mm_add_epi32(remainder, bias), modulo);
+}
+
+// value % modulo for four lanes, 0 <= value < 2^30, 0 < modulo < 2^31, where inverse holds
+// an approximation of 1 / modulo with a relative error below 2^-40.
+__attribute__((target("avx2"))) inline __m128i ModLanes(__m128i value, __m128i modulo,
+                                                       __m256d inverse) {
+    __m256d quotient = _mm256_floor_pd(_mm256_mul_pd(_mm256_cvtepi32_pd(value), inverse));
+    __m128i remainder = _mm_sub_epi32(
+        value, _mm_mullo_epi32(_mm256_cvttpd_epi32(quotient), modulo));
+    return Normalize(remainder, modulo);
+}
+
+// 1 / modulo for four lanes: a 12-bit hardware estimate refined by two Newton steps.
+__attribute__((target("avx2"))) inline __m256d InverseLanes(__m128i modulo) {
+    __m256d exact = _mm256_cvtepi32_pd(modulo);
+    __m256d inverse = _mm256_cvtps_pd(_mm_rcp_ps(_mm_cvtepi32_ps(modulo)));
+    __m256d two = _mm256_set1_pd(2.0);
+    inverse = _mm256_mul_pd(inverse, _mm256_sub_pd(two, _mm256_mul_pd(exact, inverse)));
+    inverse = _mm256_mul_pd(inverse, _mm256_sub_pd(two, _mm256_mul_pd(exact, inverse)));
+    return inverse;
+}
+
+// First level: buckets[i] = hash(keys[i]) % cnt_buckets for i < count, count % 4 == 0.
+__attribute__((target("avx2"))) inline void ComputeBucketsAvx2(
+        const int* keys, size_t count, int coefficien, int bias, int prime,
+        uint32_t cnt_buckets, uint32_t* buckets) {
+    __m128i coefficien_lanes = _mm_set1_epi32(coefficien);
+    __m128i bias_lanes = _mm_set1_epi32(bias);
+    __m128i modulo = _mm_set1_epi32(static_cast<int>(cnt_buckets));
+    __m256d inverse = _mm256_set1_pd(1.0 / cnt_buckets);
+    for (size_t i = 0; i < count; i += 4) {
+        __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i));
+        __m128i hash = HashLanes(value, coefficien_lanes, bias_lanes, prime);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(buckets + i),
+                         ModLanes(hash, modulo, inverse));
+    }
+}
+
+// Second level: records is an array of record_stride ints per bucket, each starting with
+// (offset, size, coefficien, bias) and size > 0. slots[i] = offset + hash(keys[i]) % size
+// of the record buckets[i] for i < count, count % 4 == 0.
+__attribute__((target("avx2"))) inline void ComputeSlotsAvx2(
+        const int* keys, size_t count, const uint32_t* buckets, const int* records,
+        int record_stride, int prime, uint32_t* slots) {
+    __m128i stride = _mm_set1_epi32(record_stride);
+    for (size_t i = 0; i < count; i += 4) {
+        __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i));
+        __m128i record = _mm_mullo_epi32(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(buckets + i)), stride);
+        __m128i offset = _mm_i32gather_epi32(records, record, 4);
+        __m128i size = _mm_i32gather_epi32(records + 1, record, 4);
+        __m128i coefficien = _mm_i32gather_epi32(records + 2, record, 4);
+        __m128i bias = _mm_i32gather_epi32(records + 3, record, 4);
+
+        __m128i hash = HashLanes(value, coefficien, bias, prime);
+        __m128i slot = _mm_add_epi32(offset, ModLanes(hash, size, InverseLanes(size)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(slots + i), slot);
+    }
+}
+
+// out[i] = (data[slots[i]] == keys[i]) for i < count, count % 4 == 0.
+__attribute__((target("avx2"))) inline void CompareSlotsAvx2(
+        const int* keys, size_t count, const uint32_t* slots, const int* data, uint8_t* out) {
+    for (size_t i = 0; i < count; i += 4) {
+        __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i));
+        __m128i index = _mm_loadu_si128(reinterpret_cast<const __m128i*>(slots + i));
+        __m128i equal = _mm_cmpeq_epi32(_mm_i32gather_epi32(data, index, 4), value);
+        // Turn every all-ones lane into the byte 1 and pack the low bytes together.
+        __m128i bytes = _mm_shuffle_epi8(_mm_and_si128(equal, _mm_set1_epi32(1)),
+                                         _mm_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1,
+                                                       -1, -1, -1, -1, -1, -1, -1, -1));
+        int packed = _mm_cvtsi128_si32(bytes);
+        std::memcpy(out + i, &packed, sizeof(packed));
+    }
+}
+
+#endif
+
+}  // namespace linear_hash_simd
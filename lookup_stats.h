@@ -0,0 +1,201 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <ostream>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define FIXED_SET_HAS_RDTSC 1
+#else
+#define FIXED_SET_HAS_RDTSC 0
+#endif
+
+// Lookup counters of an instrumented FixedSet, see BasicFixedSet's Instrumented flag.
+//
+// Every thread counts into its own cache line, so lookups from many threads never share a
+// written line. Counters are relaxed atomics updated by a plain load and store, which
+// compiles to ordinary moves: there is no locked instruction on the hot path, and a
+// concurrent Snapshot is still race free. One lookup in kSamplePeriod per thread is timed
+// with the time stamp counter.
+
+// Cycle counter for latency samples: rdtsc where there is one, nanoseconds otherwise.
+inline uint64_t ReadCycles() noexcept {
+#if FIXED_SET_HAS_RDTSC
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// Totals over all threads, summable across sets with +=.
+struct LookupStatsSnapshot {
+    static constexpr size_t kCntLatencyBuckets = 32;
+
+    uint64_t lookups = 0;
+    uint64_t hits = 0;
+    // Where the lookups ended: rejected by the prefilter, in an empty first-level bucket,
+    // by comparing against a bucket of up to two keys, or behind a second-level hash.
+    // Lookups into an empty set are counted in none of them.
+    uint64_t filtered = 0;
+    uint64_t empty_bucket = 0;
+    uint64_t scanned_bucket = 0;
+    uint64_t hashed_bucket = 0;
+    // latency[b] counts sampled lookups of [2^(b - 1), 2^b) cycles, latency[0] those of 0.
+    // A sampled batch contributes its cycles per key once.
+    uint64_t sampled = 0;
+    std::array<uint64_t, kCntLatencyBuckets> latency = {};
+
+    LookupStatsSnapshot& operator+=(const LookupStatsSnapshot& other) noexcept {
+        lookups += other.lookups;
+        hits += other.hits;
+        filtered += other.filtered;
+        empty_bucket += other.empty_bucket;
+        scanned_bucket += other.scanned_bucket;
+        hashed_bucket += other.hashed_bucket;
+        sampled += other.sampled;
+        for (size_t b = 0; b < kCntLatencyBuckets; ++b) {
+            latency[b] += other.latency[b];
+        }
+        return *this;
+    }
+
+    // Upper end of the latency bucket that holds the given fraction of samples, 0 without
+    // samples.
+    uint64_t GetLatencyQuantile(double fraction) const noexcept {
+        uint64_t rank = static_cast<uint64_t>(fraction * sampled);
+        uint64_t seen = 0;
+        for (size_t b = 0; b < kCntLatencyBuckets; ++b) {
+            seen += latency[b];
+            if (seen > rank) {
+                return static_cast<uint64_t>(1) << b;
+            }
+        }
+        return 0;
+    }
+
+    // One "name value" pair per line.
+    void Print(std::ostream& out) const {
+        out << "lookups " << lookups << "\n"
+            << "hits " << hits << "\n"
+            << "misses " << lookups - hits << "\n"
+            << "filtered " << filtered << "\n"
+            << "empty_bucket " << empty_bucket << "\n"
+            << "scanned_bucket " << scanned_bucket << "\n"
+            << "hashed_bucket " << hashed_bucket << "\n"
+            << "sampled " << sampled << "\n"
+            << "latency_p50_cycles " << GetLatencyQuantile(0.5) << "\n"
+            << "latency_p99_cycles " << GetLatencyQuantile(0.99) << "\n";
+        for (size_t b = 0; b < kCntLatencyBuckets; ++b) {
+            if (latency[b] > 0) {
+                out << "latency_below_" << (static_cast<uint64_t>(1) << b) << "_cycles "
+                    << latency[b] << "\n";
+            }
+        }
+    }
+};
+
+class LookupStats {
+public:
+    // Threads past the kMaxThreads-th share lines with earlier ones and may lose counts.
+    static constexpr size_t kMaxThreads = 256;
+    static constexpr uint64_t kSamplePeriod = 64;
+    static constexpr size_t kCntLatencyBuckets = LookupStatsSnapshot::kCntLatencyBuckets;
+
+    struct alignas(64) Counters {
+        std::atomic<uint64_t> lookups{0};
+        std::atomic<uint64_t> hits{0};
+        std::atomic<uint64_t> filtered{0};
+        std::atomic<uint64_t> empty_bucket{0};
+        std::atomic<uint64_t> scanned_bucket{0};
+        std::atomic<uint64_t> hashed_bucket{0};
+        std::atomic<uint64_t> sampled{0};
+        std::atomic<uint64_t> until_sample{0};
+        std::array<std::atomic<uint64_t>, kCntLatencyBuckets> latency = {};
+    };
+
+private:
+    std::unique_ptr<Counters[]> counters_;
+
+    static size_t GetThreadSlot() noexcept {
+        static std::atomic<size_t> cnt_threads{0};
+        thread_local size_t slot = cnt_threads.fetch_add(1) % kMaxThreads;
+        return slot;
+    }
+
+    static uint64_t Read(const std::atomic<uint64_t>& counter) noexcept {
+        return counter.load(std::memory_order_relaxed);
+    }
+
+public:
+    LookupStats() : counters_(new Counters[kMaxThreads]) {
+    }
+
+    // A copied or moved set counts its own lookups from zero.
+    LookupStats(const LookupStats&) : LookupStats() {
+    }
+
+    LookupStats& operator=(const LookupStats&) {
+        Reset();
+        return *this;
+    }
+
+    static void Add(std::atomic<uint64_t>& counter, uint64_t value = 1) noexcept {
+        counter.store(counter.load(std::memory_order_relaxed) + value,
+                      std::memory_order_relaxed);
+    }
+
+    Counters& Local() const noexcept {
+        return counters_[GetThreadSlot()];
+    }
+
+    // True once every kSamplePeriod calls from the thread that owns counters.
+    static bool ShouldSample(Counters& counters) noexcept {
+        uint64_t left = Read(counters.until_sample);
+        counters.until_sample.store(left == 0 ? kSamplePeriod - 1 : left - 1,
+                                    std::memory_order_relaxed);
+        return left == 0;
+    }
+
+    static void RecordLatency(Counters& counters, uint64_t cycles) noexcept {
+        size_t bucket = cycles == 0 ? 0 : 64 - __builtin_clzll(cycles);
+        Add(counters.latency[bucket < kCntLatencyBuckets ? bucket : kCntLatencyBuckets - 1]);
+        Add(counters.sampled);
+    }
+
+    LookupStatsSnapshot Snapshot() const noexcept {
+        LookupStatsSnapshot snapshot;
+        for (size_t t = 0; t < kMaxThreads; ++t) {
+            const Counters& counters = counters_[t];
+            snapshot.lookups += Read(counters.lookups);
+            snapshot.hits += Read(counters.hits);
+            snapshot.filtered += Read(counters.filtered);
+            snapshot.empty_bucket += Read(counters.empty_bucket);
+            snapshot.scanned_bucket += Read(counters.scanned_bucket);
+            snapshot.hashed_bucket += Read(counters.hashed_bucket);
+            snapshot.sampled += Read(counters.sampled);
+            for (size_t b = 0; b < kCntLatencyBuckets; ++b) {
+                snapshot.latency[b] += Read(counters.latency[b]);
+            }
+        }
+        return snapshot;
+    }
+
+    // Must not run concurrently with lookups.
+    void Reset() noexcept {
+        for (size_t t = 0; t < kMaxThreads; ++t) {
+            counters_[t].~Counters();
+            new (&counters_[t]) Counters();
+        }
+    }
+};
+
+// Stands in for LookupStats in sets that are not instrumented.
+struct NoLookupStats {
+};
@@ -0,0 +1,217 @@
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// A whole file mapped read-only into memory. Pages are shared with every other process
+// mapping the same file, and are only read from disk when first touched.
+class MappedFile {
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+
+    [[noreturn]] static void Fail(const std::string& what, const std::string& path) {
+        throw std::runtime_error(what + " " + path + ": " + std::strerror(errno));
+    }
+
+public:
+    explicit MappedFile(const std::string& path) {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            Fail("Cannot open", path);
+        }
+        struct stat status;
+        if (fstat(fd, &status) != 0) {
+            close(fd);
+            Fail("Cannot stat", path);
+        }
+        size_ = status.st_size;
+        if (size_ > 0) {
+            void* data = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+            if (data == MAP_FAILED) {
+                close(fd);
+                Fail("Cannot map", path);
+            }
+            data_ = static_cast<const char*>(data);
+        }
+        close(fd);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        if (data_) {
+            munmap(const_cast<char*>(data_), size_);
+        }
+    }
+
+    const char* Data() const noexcept {
+        return data_;
+    }
+
+    size_t Size() const noexcept {
+        return size_;
+    }
+};
+
+// A fresh name next to path for a file that is to replace it, see ReplaceFile.
+inline std::string MakeTempPath(const std::string& path) {
+    static std::atomic<uint64_t> counter{0};
+    return path + ".tmp." + std::to_string(getpid()) + "." + std::to_string(counter++);
+}
+
+// Puts the file at temp in place of path once its contents are on disk. rename(2) swaps
+// the name atomically: a process that has the old file mapped keeps reading the old file,
+// and one that opens path afterwards sees all of the new one, never a mix. If this fails,
+// temp is removed and path is left as it was.
+inline void ReplaceFile(const std::string& temp, const std::string& path) {
+    int fd = open(temp.c_str(), O_RDONLY | O_CLOEXEC);
+    bool synced = fd >= 0 && fsync(fd) == 0;
+    if (synced && rename(temp.c_str(), path.c_str()) == 0) {
+        close(fd);
+        return;
+    }
+    std::string error = std::strerror(errno);
+    if (fd >= 0) {
+        close(fd);
+    }
+    std::remove(temp.c_str());
+    throw std::runtime_error("Cannot write " + path + ": " + error);
+}
+
+// A read-mostly array that either owns its elements or views elements owned elsewhere,
+// e.g. by a MappedFile. Lookups go through one pointer in both cases. Only an owning
+// table can be written to, and any modification first turns a view into an empty owning
+// table. The method names follow std::vector so a table can stand in for one, Allocator
+// provides the owned memory.
+template <class T, class Allocator = std::allocator<T>>
+class Table {
+    std::vector<T, Allocator> owned_;
+    const T* data_ = nullptr;
+    size_t size_ = 0;
+
+    void Own() noexcept {
+        data_ = owned_.data();
+        size_ = owned_.size();
+    }
+
+public:
+    Table() = default;
+
+    Table(const Table& other) : owned_(other.owned_), data_(other.data_), size_(other.size_) {
+        if (other.IsOwning()) {
+            Own();
+        }
+    }
+
+    Table& operator=(const Table& other) {
+        Table copy(other);
+        *this = std::move(copy);
+        return *this;
+    }
+
+    Table(Table&& other) noexcept {
+        *this = std::move(other);
+    }
+
+    Table& operator=(Table&& other) noexcept {
+        bool owning = other.IsOwning();
+        owned_ = std::move(other.owned_);
+        data_ = other.data_;
+        size_ = other.size_;
+        if (owning) {
+            Own();
+        }
+        other.owned_.clear();
+        other.Own();
+        return *this;
+    }
+
+    // Makes the table a view of size elements at data, which must outlive it.
+    void View(const T* data, size_t size) {
+        std::vector<T, Allocator>().swap(owned_);
+        data_ = data;
+        size_ = size;
+    }
+
+    bool IsOwning() const noexcept {
+        return data_ == owned_.data();
+    }
+
+    // Turns a view into an owning copy of the viewed elements, so that it can be modified
+    // in place.
+    void Detach() {
+        if (!IsOwning()) {
+            owned_.assign(data_, data_ + size_);
+            Own();
+        }
+    }
+
+    void assign(size_t size, const T& value) {
+        owned_.assign(size, value);
+        Own();
+    }
+
+    void resize(size_t size) {
+        if (!IsOwning()) {
+            owned_.clear();
+        }
+        owned_.resize(size);
+        Own();
+    }
+
+    void clear() noexcept {
+        owned_.clear();
+        Own();
+    }
+
+    size_t size() const noexcept {
+        return size_;
+    }
+
+    bool empty() const noexcept {
+        return size_ == 0;
+    }
+
+    // Elements held in memory: the allocation of an owning table, the viewed range otherwise.
+    size_t capacity() const noexcept {
+        return IsOwning() ? owned_.capacity() : size_;
+    }
+
+    const T* data() const noexcept {
+        return data_;
+    }
+
+    T* data() noexcept {
+        return owned_.data();
+    }
+
+    const T& operator[](size_t index) const noexcept {
+        return data_[index];
+    }
+
+    T& operator[](size_t index) noexcept {
+        return owned_[index];
+    }
+
+    const T* begin() const noexcept {
+        return data_;
+    }
+
+    const T* end() const noexcept {
+        return data_ + size_;
+    }
+};
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Runs task(0, worker), ..., task(cnt_tasks - 1, worker) on cnt_threads threads, the calling
+// one included, where worker in [0, cnt_threads) identifies the thread running the task, so
+// tasks can use per-thread scratch space. Threads claim the next unstarted task from a
+// shared counter, so uneven tasks balance out as long as there are many more tasks than
+// threads. The first exception thrown by a task stops the remaining tasks from starting and
+// is rethrown once every thread has finished.
+template <class Task>
+void ParallelForWithWorker(int cnt_threads, size_t cnt_tasks, Task task) {
+    cnt_threads = static_cast<int>(std::min<size_t>(std::max(cnt_threads, 1), cnt_tasks));
+    if (cnt_threads <= 1) {
+        for (size_t i = 0; i < cnt_tasks; ++i) {
+            task(i, 0);
+        }
+        return;
+    }
+
+    std::atomic<size_t> next_task{0};
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    auto worker = [&](int worker_index) {
+        size_t i;
+        while ((i = next_task.fetch_add(1, std::memory_order_relaxed)) < cnt_tasks) {
+            try {
+                task(i, worker_index);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+                next_task.store(cnt_tasks, std::memory_order_relaxed);
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(cnt_threads - 1);
+    for (int i = 1; i < cnt_threads; ++i) {
+        threads.emplace_back(worker, i);
+    }
+    worker(0);
+    for (auto& thread: threads) {
+        thread.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+// ParallelForWithWorker for tasks that need no per-thread state: runs task(i).
+template <class Task>
+void ParallelFor(int cnt_threads, size_t cnt_tasks, Task task) {
+    ParallelForWithWorker(cnt_threads, cnt_tasks, [&](size_t i, int) { task(i); });
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <type_traits>
+#include <vector>
+
+// LSD radix sort of integers, eight bits per pass. buffer is scratch space of any content,
+// both vectors may exchange their allocations. Passes where every value has the same
+// digit are skipped, so keys of a narrow range cost fewer than sizeof(Integer) passes.
+template <class Integer>
+void RadixSort(std::vector<Integer>& values, std::vector<Integer>& buffer) {
+    static_assert(std::is_integral_v<Integer>, "RadixSort sorts integers only");
+    using Unsigned = std::make_unsigned_t<Integer>;
+    // Flipping the sign bit orders signed values like their unsigned images.
+    constexpr Unsigned kSignBit =
+        std::is_signed_v<Integer> ? static_cast<Unsigned>(1) << (sizeof(Integer) * 8 - 1) : 0;
+    auto digit = [](Integer value, int shift) {
+        return ((static_cast<Unsigned>(value) ^ kSignBit) >> shift) & 0xFF;
+    };
+
+    if (values.size() < 2) {
+        return;
+    }
+    buffer.resize(values.size());
+    for (int shift = 0; shift < static_cast<int>(sizeof(Integer) * 8); shift += 8) {
+        size_t starts[257] = {};
+        for (Integer value: values) {
+            ++starts[digit(value, shift) + 1];
+        }
+        if (starts[digit(values.front(), shift) + 1] == values.size()) {
+            continue;
+        }
+        for (int i = 0; i < 256; ++i) {
+            starts[i + 1] += starts[i];
+        }
+        for (Integer value: values) {
+            buffer[starts[digit(value, shift)]++] = value;
+        }
+        values.swap(buffer);
+    }
+}
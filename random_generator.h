@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <random>
+
+// splitmix64 finalizer: a cheap bijective mix of 64 bits, used to derive independent seeds
+// from one build seed and as a general-purpose integer hash.
+constexpr uint64_t SplitMix64(uint64_t value) noexcept {
+    value += 0x9e3779b97f4a7c15;
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111eb;
+    return value ^ (value >> 31);
+}
+
+// xoshiro256** by Blackman and Vigna. 32 bytes of state instead of the 5 KB of
+// std::mt19937, so generators are cheap to create per task, and a few cycles per number.
+// Together with Uniform it yields the same sequence with every standard library, unlike
+// std::uniform_int_distribution, which keeps seeded builds reproducible everywhere.
+class Xoshiro256 {
+    uint64_t state_[4] = {};
+
+    static constexpr uint64_t RotateLeft(uint64_t value, int shift) noexcept {
+        return (value << shift) | (value >> (64 - shift));
+    }
+
+public:
+    using result_type = uint64_t;
+
+    // The state is the splitmix64 sequence started at seed, which is never all zero.
+    explicit constexpr Xoshiro256(uint64_t seed) noexcept {
+        for (int i = 0; i < 4; ++i) {
+            state_[i] = SplitMix64(seed + i * 0x9e3779b97f4a7c15);
+        }
+    }
+
+    // Seeds from std::random_device.
+    Xoshiro256() : Xoshiro256(DrawSeed()) {
+    }
+
+    static uint64_t DrawSeed() {
+        std::random_device device;
+        return (static_cast<uint64_t>(device()) << 32) | device();
+    }
+
+    static constexpr result_type min() noexcept {
+        return 0;
+    }
+
+    static constexpr result_type max() noexcept {
+        return std::numeric_limits<result_type>::max();
+    }
+
+    constexpr result_type operator()() noexcept {
+        uint64_t result = RotateLeft(state_[1] * 5, 7) * 9;
+        uint64_t shifted = state_[1] << 17;
+        state_[2] ^= state_[0];
+        state_[3] ^= state_[1];
+        state_[1] ^= state_[2];
+        state_[0] ^= state_[3];
+        state_[2] ^= shifted;
+        state_[3] = RotateLeft(state_[3], 45);
+        return result;
+    }
+
+    // A number in [0, bound) by a multiply instead of a division. The bias is below
+    // bound / 2^32, negligible for drawing hash parameters.
+    constexpr uint32_t Uniform(uint32_t bound) noexcept {
+        return ((*this)() >> 32) * bound >> 32;
+    }
+};
@@ -2,53 +2,232 @@
 #include <vector>
 #include <stdexcept>
 #include <cstring>
+#include <limits>
+#include <numeric>
+#include <string>
+#include <string_view>
+#include <exception>
+#include <thread>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <cstdlib>
+
+#include <fcntl.h>
 
 int rand() {  // NOLINT
     throw std::runtime_error("Don't use rand");
 }
 
 #include "fixed_set.h"
+#include "compact_fixed_set.h"
+#include "concurrent_fixed_set.h"
+#include "fixed_set_file_builder.h"
+#include "sharded_fixed_set.h"
+#include "static_fixed_set.h"
+#include "fast_io.h"
+#include "spsc_ring.h"
 
-std::vector<int> ReadSequence() {
-    size_t size;
-    std::cin >> size;
-    std::vector<int> sequence(size);
-    for (auto& current : sequence) {
-        std::cin >> current;
+std::vector<int> ReadSequence(InputReader& reader) {
+    size_t size = 0;
+    reader.Read(size);
+    std::vector<int> sequence;
+    sequence.reserve(size);
+    int current;
+    while (sequence.size() < size && reader.Read(current)) {
+        sequence.push_back(current);
+    }
+    if (sequence.size() < size) {
+        throw std::runtime_error("Unexpected end of input");
     }
     return sequence;
 }
 
-std::vector<bool> PerformRequests(const std::vector<int>& requests, const FixedSet& set) {
-    std::vector<bool> request_answers;
-    request_answers.reserve(requests.size());
-    for (int request: requests) {
-        request_answers.push_back(set.Contains(request));
+// Answers the requests in chunks and writes every answer out as soon as its chunk is done,
+// so no answer vector is ever materialized.
+template <class Set>
+void PerformRequests(const std::vector<int>& requests, const Set& set, OutputWriter& writer) {
+    constexpr size_t kChunkSize = 1 << 12;
+    uint8_t answers[kChunkSize];
+    for (size_t start = 0; start < requests.size(); start += kChunkSize) {
+        size_t count = std::min(kChunkSize, requests.size() - start);
+        set.ContainsBatch(requests.data() + start, count, answers);
+        for (size_t i = 0; i < count; ++i) {
+            writer.Write(answers[i] ? "Yes\n" : "No\n");
+        }
+    }
+}
+
+// PerformRequests with the lookups spread over cnt_threads threads, the calling one
+// included. Threads claim chunks of requests and answer each with one ContainsBatch
+// straight into its range of a preallocated answer array, which is printed in order once
+// every chunk is done. Chunks are small enough for their keys and answers to stay in L1.
+template <class Set>
+void PerformRequestsParallel(const std::vector<int>& requests, const Set& set,
+                             OutputWriter& writer, int cnt_threads) {
+    constexpr size_t kChunkSize = 1 << 12;
+    std::vector<uint8_t> answers(requests.size());
+    size_t cnt_chunks = (requests.size() + kChunkSize - 1) / kChunkSize;
+    ParallelFor(cnt_threads, cnt_chunks, [&](size_t chunk) {
+        size_t start = chunk * kChunkSize;
+        size_t count = std::min(kChunkSize, requests.size() - start);
+        set.ContainsBatch(requests.data() + start, count, answers.data() + start);
+    });
+    for (uint8_t answer : answers) {
+        writer.Write(answer ? "Yes\n" : "No\n");
+    }
+}
+
+// Reads, answers and prints the request sequence as a pipeline: a reader thread parses
+// chunks of requests, the calling thread looks them up and a writer thread prints the
+// answers. The stages pass a fixed pool of chunk_size chunks around through SPSC rings, so
+// memory does not depend on the number of requests and the stages run concurrently.
+template <class Set>
+void PerformRequestsStreaming(InputReader& reader, const Set& set, OutputWriter& writer,
+                              size_t chunk_size = 1 << 14, size_t cnt_chunks = 8) {
+    struct Chunk {
+        std::vector<int> keys;
+        std::vector<uint8_t> answers;
+        size_t count = 0;
+        bool last = false;
+    };
+    std::vector<Chunk> chunks(cnt_chunks);
+    SpscRing<Chunk*> free(cnt_chunks);
+    SpscRing<Chunk*> filled(cnt_chunks);
+    SpscRing<Chunk*> answered(cnt_chunks);
+    for (auto& chunk : chunks) {
+        chunk.keys.resize(chunk_size);
+        chunk.answers.resize(chunk_size);
+        free.Push(&chunk);
+    }
+
+    // Every stage reads chunk->last before passing the chunk on, it may be reused after.
+    std::exception_ptr read_error;
+    std::thread read_thread([&] {
+        Chunk* chunk = nullptr;
+        try {
+            size_t remaining = 0;
+            reader.Read(remaining);
+            do {
+                chunk = free.Pop();
+                chunk->count = 0;
+                for (; chunk->count < chunk_size && remaining > 0; ++chunk->count, --remaining) {
+                    if (!reader.Read(chunk->keys[chunk->count])) {
+                        throw std::runtime_error("Unexpected end of input");
+                    }
+                }
+                chunk->last = remaining == 0;
+                filled.Push(std::exchange(chunk, nullptr));
+            } while (remaining > 0);
+        } catch (...) {
+            read_error = std::current_exception();
+            if (!chunk) {
+                chunk = free.Pop();
+            }
+            chunk->count = 0;
+            chunk->last = true;
+            filled.Push(chunk);
+        }
+    });
+
+    std::exception_ptr write_error;
+    std::thread write_thread([&] {
+        bool last;
+        do {
+            Chunk* chunk = answered.Pop();
+            if (!write_error) {
+                try {
+                    for (size_t i = 0; i < chunk->count; ++i) {
+                        writer.Write(chunk->answers[i] ? "Yes\n" : "No\n");
+                    }
+                } catch (...) {
+                    // Keep draining so that the other stages can finish.
+                    write_error = std::current_exception();
+                }
+            }
+            last = chunk->last;
+            free.Push(chunk);
+        } while (!last);
+    });
+
+    bool last;
+    do {
+        Chunk* chunk = filled.Pop();
+        set.ContainsBatch(chunk->keys.data(), chunk->count, chunk->answers.data());
+        last = chunk->last;
+        answered.Push(chunk);
+    } while (!last);
+
+    read_thread.join();
+    write_thread.join();
+    if (read_error) {
+        std::rethrow_exception(read_error);
+    }
+    if (write_error) {
+        std::rethrow_exception(write_error);
     }
-    return request_answers;
 }
 
-void PrintRequestsResponse(const std::vector<bool>& request_answers) {
-    for (bool answer: request_answers) {
-        std::cout << (answer ? "Yes" : "No") << "\n";
+// Reads the keys and the requests and prints the answers. cnt_threads threads build the
+// set and, unless streaming, answer the requests.
+template <class Set>
+void Run(InputReader& reader, OutputWriter& writer, bool stream, int cnt_threads, Set& set) {
+    auto numbers = ReadSequence(reader);
+    if (stream) {
+        set.Initialize(numbers, cnt_threads);
+        PerformRequestsStreaming(reader, set, writer);
+    } else {
+        auto requests = ReadSequence(reader);
+        set.Initialize(numbers, cnt_threads);
+        if (cnt_threads > 1) {
+            PerformRequestsParallel(requests, set, writer, cnt_threads);
+        } else {
+            PerformRequests(requests, set, writer);
+        }
     }
+    writer.Flush();
 }
 
 void RunTests();
 
 int main(int argc, char **argv) {
-    if (argc > 1 && !strcmp(argv[1], "--testing")) {
-        RunTests();
-        return 0;
+    bool stream = false;
+    bool stats = false;
+    int cnt_threads = 1;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--testing")) {
+            RunTests();
+            return 0;
+        } else if (!strcmp(argv[i], "--stream")) {
+            stream = true;
+        } else if (!strcmp(argv[i], "--stats")) {
+            // Counts the lookups and prints the counters to stderr when done.
+            stats = true;
+        } else if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+            cnt_threads = std::atoi(argv[++i]);
+            if (cnt_threads < 1) {
+                std::cerr << "--threads needs a positive number\n";
+                return 1;
+            }
+        } else {
+            std::cerr << "Unknown option " << argv[i] << "\n";
+            return 1;
+        }
     }
 
     std::ios::sync_with_stdio(false);
 
-    auto numbers = ReadSequence();
-    auto requests = ReadSequence();
-    FixedSet set;
-    set.Initialize(numbers);
-    PrintRequestsResponse(PerformRequests(requests, set));
+    InputReader reader(STDIN_FILENO);
+    OutputWriter writer(STDOUT_FILENO);
+    if (stats) {
+        InstrumentedFixedSet set;
+        Run(reader, writer, stream, cnt_threads, set);
+        set.GetLookupStats().Print(std::cerr);
+    } else {
+        FixedSet set;
+        Run(reader, writer, stream, cnt_threads, set);
+    }
 
     return 0;
 }
@@ -103,6 +282,1513 @@ void RepeatInitialize() {
     }
 }
 
+void Dense() {
+    for (int elements_count = 1; elements_count < 50; ++elements_count) {
+        std::vector<int> elements;
+        for (int i = 0; i < elements_count; ++i) {
+            elements.push_back(i * 3);
+        }
+        FixedSet set;
+        set.Initialize(elements);
+        for (int elem = -100; elem < 200; ++elem) {
+            ASSERT_EQ(elem >= 0 && elem % 3 == 0 && elem / 3 < elements_count, set.Contains(elem));
+        }
+    }
+}
+
+void Big() {
+    std::mt19937 generator(42);
+    std::uniform_int_distribution<int> distribution(0, 1'000'000'000);
+    std::vector<int> elements;
+    for (int i = 0; i < 100'000; ++i) {
+        elements.push_back(distribution(generator));
+    }
+    std::sort(elements.begin(), elements.end());
+    elements.erase(std::unique(elements.begin(), elements.end()), elements.end());
+    FixedSet set;
+    set.Initialize(elements);
+    for (auto elem : elements) {
+        ASSERT_EQ(true, set.Contains(elem));
+    }
+    for (int i = 0; i < 100'000; ++i) {
+        int elem = distribution(generator);
+        ASSERT_EQ(std::binary_search(elements.begin(), elements.end(), elem), set.Contains(elem));
+    }
+}
+
+void ParallelInitialize() {
+    std::vector<int> elements;
+    for (int i = 0; i < 300'000; ++i) {
+        elements.push_back(i * 7 - 1'000'000);
+    }
+    FixedSet set;
+    set.Initialize(elements, 4);
+    for (auto elem : elements) {
+        ASSERT_EQ(true, set.Contains(elem));
+        ASSERT_EQ(false, set.Contains(elem + 1));
+    }
+    set.Initialize({}, 4);
+    ASSERT_EQ(false, set.Contains(0));
+    set.Initialize({5}, 4);
+    ASSERT_EQ(true, set.Contains(5));
+}
+
+void SharedArena() {
+    FixedSetArena arena;
+    FixedSet first;
+    FixedSet second;
+    for (int elements_count : {1'000, 10, 5'000, 0, 200}) {
+        std::vector<int> elements;
+        for (int i = 0; i < elements_count; ++i) {
+            elements.push_back(i * 11);
+        }
+        first.Initialize(elements, 1, arena);
+        second.Initialize(elements, 2, arena);
+        for (auto elem : elements) {
+            ASSERT_EQ(true, first.Contains(elem));
+            ASSERT_EQ(true, second.Contains(elem));
+        }
+        ASSERT_EQ(false, first.Contains(-11));
+        ASSERT_EQ(false, second.Contains(elements_count * 11));
+    }
+}
+
+void IndexOf() {
+    FixedSet set;
+    set.Initialize({});
+    ASSERT_EQ(false, set.IndexOf(0).has_value());
+    std::vector<int> elements;
+    for (int i = 0; i < 50'000; ++i) {
+        elements.push_back(i * 9 + 4);
+    }
+    set.Initialize(elements, 2);
+    ASSERT_EQ(elements.size(), set.Size());
+    std::vector<uint8_t> seen(elements.size(), 0);
+    for (auto elem : elements) {
+        auto index = set.IndexOf(elem);
+        ASSERT_EQ(true, index.has_value());
+        ASSERT_EQ(true, index.value() < elements.size());
+        ASSERT_EQ(0, seen[index.value()]);
+        seen[index.value()] = 1;
+        ASSERT_EQ(false, set.IndexOf(elem + 1).has_value());
+    }
+}
+
+void Batch() {
+    std::mt19937 generator(7);
+    std::uniform_int_distribution<int> distribution(0, 100'000);
+    std::vector<int> elements;
+    for (int i = 0; i < 100'000; i += 3) {
+        elements.push_back(i);
+    }
+    FixedSet set;
+    set.Initialize(elements);
+    std::vector<int> requests;
+    for (int i = 0; i < 1'000; ++i) {
+        requests.push_back(distribution(generator));
+    }
+    std::vector<uint8_t> answers(requests.size());
+    set.ContainsBatch(requests.data(), requests.size(), answers.data());
+    for (size_t i = 0; i < requests.size(); ++i) {
+        ASSERT_EQ(set.Contains(requests[i]), static_cast<bool>(answers[i]));
+    }
+
+    FixedSet empty;
+    empty.Initialize({});
+    empty.ContainsBatch(requests.data(), requests.size(), answers.data());
+    ASSERT_EQ(true, std::all_of(answers.begin(), answers.end(),
+                                [](uint8_t answer) { return answer == 0; }));
+}
+
+// Buckets of one and two keys are scanned instead of hashed, every lookup path has to find
+// both keys of a pair.
+void SmallBuckets() {
+    std::vector<int> elements;
+    for (int i = 0; i < 100'000; ++i) {
+        elements.push_back(i * 5 - 250'000);
+    }
+    std::vector<int> misses;
+    for (int elem : elements) {
+        misses.push_back(elem + 2);
+    }
+    for (int cnt_threads : {1, 3}) {
+        FixedSet set;
+        set.Initialize(elements, cnt_threads, 21);
+        const BuildStats& stats = set.GetBuildStats();
+        ASSERT_EQ(true, stats.bucket_size_histogram.size() > 2);
+        ASSERT_EQ(true, stats.bucket_size_histogram[2] > 0);
+        std::vector<uint8_t> answers(elements.size());
+        set.ContainsBatch(elements.data(), elements.size(), answers.data());
+        ASSERT_EQ(true, std::all_of(answers.begin(), answers.end(),
+                                    [](uint8_t answer) { return answer == 1; }));
+        set.ContainsBatch(misses.data(), misses.size(), answers.data());
+        ASSERT_EQ(true, std::all_of(answers.begin(), answers.end(),
+                                    [](uint8_t answer) { return answer == 0; }));
+        std::vector<uint8_t> seen(elements.size(), 0);
+        for (size_t i = 0; i < elements.size(); ++i) {
+            ASSERT_EQ(true, set.Contains(elements[i]));
+            ASSERT_EQ(false, set.Contains(misses[i]));
+            uint32_t index = set.IndexOf(elements[i]).value();
+            ASSERT_EQ(0, seen[index]);
+            seen[index] = 1;
+        }
+    }
+
+    std::vector<std::string> words = {"a", "b", "pair", "of", "tiny", "buckets"};
+    std::vector<std::string_view> views(words.begin(), words.end());
+    BasicFixedSet<std::string_view> strings;
+    strings.Initialize(views);
+    for (std::string_view word : views) {
+        ASSERT_EQ(true, strings.Contains(word));
+    }
+    ASSERT_EQ(false, strings.Contains("c"));
+}
+
+void BatchExtremes() {
+    std::mt19937 generator(13);
+    std::uniform_int_distribution<int> keys(-500'000'000, 500'000'000);
+    std::uniform_int_distribution<int> any(std::numeric_limits<int>::min(),
+                                           std::numeric_limits<int>::max());
+    std::vector<int> elements;
+    for (int i = 0; i < 10'000; ++i) {
+        elements.push_back(keys(generator));
+    }
+    std::sort(elements.begin(), elements.end());
+    elements.erase(std::unique(elements.begin(), elements.end()), elements.end());
+    FixedSet set;
+    set.Initialize(elements);
+    std::vector<int> requests(elements.begin(), elements.end());
+    for (int i = 0; i < 10'000; ++i) {
+        requests.push_back(any(generator));
+    }
+    requests.push_back(std::numeric_limits<int>::min());
+    requests.push_back(std::numeric_limits<int>::max());
+    std::shuffle(requests.begin(), requests.end(), generator);
+    std::vector<uint8_t> answers(requests.size());
+    set.ContainsBatch(requests.data(), requests.size(), answers.data());
+    for (size_t i = 0; i < requests.size(); ++i) {
+        ASSERT_EQ(set.Contains(requests[i]), static_cast<bool>(answers[i]));
+    }
+}
+
+void MultiplyShift() {
+    std::mt19937 generator(17);
+    std::uniform_int_distribution<int> any(std::numeric_limits<int>::min(),
+                                           std::numeric_limits<int>::max());
+    std::vector<int> elements = {-1'000'000'000, -1'000'000'000 + GenerateLinearHashFunction::kPrime};
+    for (int i = 0; i < 10'000; ++i) {
+        elements.push_back(any(generator));
+    }
+    std::sort(elements.begin(), elements.end());
+    elements.erase(std::unique(elements.begin(), elements.end()), elements.end());
+    BasicFixedSet<int, MultiplyShiftHashPolicy> set;
+    set.Initialize(elements);
+    for (auto elem : elements) {
+        ASSERT_EQ(true, set.Contains(elem));
+    }
+    std::vector<int> requests;
+    for (int i = 0; i < 10'000; ++i) {
+        requests.push_back(any(generator));
+    }
+    std::vector<uint8_t> answers(requests.size());
+    set.ContainsBatch(requests.data(), requests.size(), answers.data());
+    for (size_t i = 0; i < requests.size(); ++i) {
+        bool expected = std::binary_search(elements.begin(), elements.end(), requests[i]);
+        ASSERT_EQ(expected, set.Contains(requests[i]));
+        ASSERT_EQ(expected, static_cast<bool>(answers[i]));
+    }
+}
+
+void WideKeys() {
+    std::mt19937_64 generator(23);
+    std::vector<int64_t> elements = {std::numeric_limits<int64_t>::min(),
+                                     std::numeric_limits<int64_t>::max(), 0, -1};
+    // Keys that only differ in the high half must not collide.
+    for (int64_t i = 1; i <= 1'000; ++i) {
+        elements.push_back(i << 32);
+    }
+    for (int i = 0; i < 10'000; ++i) {
+        elements.push_back(static_cast<int64_t>(generator()));
+    }
+    std::sort(elements.begin(), elements.end());
+    elements.erase(std::unique(elements.begin(), elements.end()), elements.end());
+    BasicFixedSet<int64_t> set;
+    set.Initialize(elements, 4);
+    for (auto elem : elements) {
+        ASSERT_EQ(true, set.Contains(elem));
+    }
+    for (int64_t i = 1; i <= 1'000; ++i) {
+        ASSERT_EQ(false, set.Contains((i << 32) + 1));
+    }
+    std::vector<int64_t> requests(elements);
+    for (int i = 0; i < 10'000; ++i) {
+        requests.push_back(static_cast<int64_t>(generator()));
+    }
+    std::vector<uint8_t> answers(requests.size());
+    set.ContainsBatch(requests.data(), requests.size(), answers.data());
+    for (size_t i = 0; i < requests.size(); ++i) {
+        bool expected = std::binary_search(elements.begin(), elements.end(), requests[i]);
+        ASSERT_EQ(expected, static_cast<bool>(answers[i]));
+    }
+}
+
+void StringKeys() {
+    std::vector<std::string> words = {"", "a", "b", "ab", "ba", "abcdefgh", "abcdefghi",
+                                      std::string(1'000, 'x')};
+    for (int i = 0; i < 10'000; ++i) {
+        words.push_back("key-" + std::to_string(i * 7));
+    }
+    std::vector<std::string_view> elements(words.begin(), words.end());
+    BasicFixedSet<std::string_view> set;
+    set.Initialize(elements);
+    // The set keeps its own copy of the keys.
+    std::vector<std::string> copies(words);
+    words.assign(words.size(), "gone");
+    for (const auto& word : copies) {
+        ASSERT_EQ(true, set.Contains(word));
+    }
+    for (int i = 0; i < 10'000; ++i) {
+        ASSERT_EQ(i % 7 == 0, set.Contains("key-" + std::to_string(i)));
+    }
+    ASSERT_EQ(false, set.Contains("abcdefg"));
+    ASSERT_EQ(false, set.Contains(std::string(1'000, 'y')));
+    ASSERT_EQ(false, set.Contains(std::string_view("a\0", 2)));
+    auto index = set.IndexOf("ab");
+    ASSERT_EQ(true, index.has_value());
+    ASSERT_EQ(true, *index < copies.size());
+}
+
+// Feeds text to an InputReader through a pipe.
+template <class Check>
+void WithReader(const std::string& text, size_t buffer_size, Check check) {
+    int fds[2];
+    ASSERT_EQ(0, pipe(fds));
+    ASSERT_EQ(static_cast<ssize_t>(text.size()), write(fds[1], text.data(), text.size()));
+    close(fds[1]);
+    InputReader reader(fds[0], buffer_size);
+    try {
+        check(reader);
+    } catch (...) {
+        close(fds[0]);
+        throw;
+    }
+    close(fds[0]);
+}
+
+void Reader() {
+    for (size_t buffer_size : {1, 3, 1 << 20}) {
+        WithReader("3\n1 -20 +300\r\n\t2\n  -2147483648 2147483647", buffer_size,
+                   [](InputReader& reader) {
+            auto numbers = ReadSequence(reader);
+            ASSERT_EQ(3u, numbers.size());
+            ASSERT_EQ(1, numbers[0]);
+            ASSERT_EQ(-20, numbers[1]);
+            ASSERT_EQ(300, numbers[2]);
+            auto requests = ReadSequence(reader);
+            ASSERT_EQ(2u, requests.size());
+            ASSERT_EQ(std::numeric_limits<int>::min(), requests[0]);
+            ASSERT_EQ(std::numeric_limits<int>::max(), requests[1]);
+            int value;
+            ASSERT_EQ(false, reader.Read(value));
+        });
+    }
+    WithReader("0\n0\n", 2, [](InputReader& reader) {
+        ASSERT_EQ(0u, ReadSequence(reader).size());
+        ASSERT_EQ(0u, ReadSequence(reader).size());
+    });
+    WithReader("2 1", 4, [](InputReader& reader) {
+        bool thrown = false;
+        try {
+            ReadSequence(reader);
+        } catch (const std::runtime_error&) {
+            thrown = true;
+        }
+        ASSERT_EQ(true, thrown);
+    });
+}
+
+void Writer() {
+    for (size_t buffer_size : {1, 3, 1 << 20}) {
+        int fds[2];
+        ASSERT_EQ(0, pipe(fds));
+        std::vector<int> elements = {1, 5, 7};
+        FixedSet set;
+        set.Initialize(elements);
+        {
+            OutputWriter writer(fds[1], buffer_size);
+            PerformRequests({5, 6, 1, -1}, set, writer);
+            writer.Write("long text");
+            writer.Flush();
+        }
+        close(fds[1]);
+        std::string text;
+        char buffer[64];
+        ssize_t read_bytes;
+        while ((read_bytes = read(fds[0], buffer, sizeof(buffer))) > 0) {
+            text.append(buffer, read_bytes);
+        }
+        close(fds[0]);
+        ASSERT_EQ(std::string("Yes\nNo\nYes\nNo\nlong text"), text);
+    }
+}
+
+void Ring() {
+    SpscRing<int> ring(3);
+    int value = 1;
+    ASSERT_EQ(false, ring.TryPop(value));
+    for (int i = 0; i < 3; ++i) {
+        ASSERT_EQ(true, ring.TryPush(value));
+    }
+    ASSERT_EQ(false, ring.TryPush(value));
+    for (int i = 0; i < 3; ++i) {
+        ring.Pop();
+    }
+    const int count = 100'000;
+    std::thread producer([&] {
+        for (int i = 0; i < count; ++i) {
+            ring.Push(i);
+        }
+    });
+    long long sum = 0;
+    bool ordered = true;
+    for (int i = 0; i < count; ++i) {
+        int current = ring.Pop();
+        ordered = ordered && current == i;
+        sum += current;
+    }
+    producer.join();
+    ASSERT_EQ(true, ordered);
+    ASSERT_EQ(static_cast<long long>(count) * (count - 1) / 2, sum);
+}
+
+void Stream() {
+    FixedSet set;
+    set.Initialize({1, 5, 7});
+    std::string input = "10\n";
+    std::string expected;
+    for (int i = 0; i < 10; ++i) {
+        input += std::to_string(i) + " ";
+        expected += i == 1 || i == 5 || i == 7 ? "Yes\n" : "No\n";
+    }
+    for (size_t chunk_size : {1, 3, 100}) {
+        for (std::string text : {input, std::string("0\n")}) {
+            int fds[2];
+            ASSERT_EQ(0, pipe(fds));
+            {
+                OutputWriter writer(fds[1]);
+                WithReader(text, 4, [&](InputReader& reader) {
+                    PerformRequestsStreaming(reader, set, writer, chunk_size, 2);
+                });
+            }
+            close(fds[1]);
+            std::string output;
+            char buffer[64];
+            ssize_t read_bytes;
+            while ((read_bytes = read(fds[0], buffer, sizeof(buffer))) > 0) {
+                output.append(buffer, read_bytes);
+            }
+            close(fds[0]);
+            ASSERT_EQ(text == input ? expected : std::string(), output);
+        }
+    }
+    int fds[2];
+    ASSERT_EQ(0, pipe(fds));
+    WithReader("3 1 2", 2, [&](InputReader& reader) {
+        OutputWriter writer(fds[1]);
+        bool thrown = false;
+        try {
+            PerformRequestsStreaming(reader, set, writer, 1, 2);
+        } catch (const std::runtime_error&) {
+            thrown = true;
+        }
+        ASSERT_EQ(true, thrown);
+    });
+    close(fds[0]);
+    close(fds[1]);
+}
+
+template <class Set, class Key>
+void ExpectSameAnswers(const Set& expected, const Set& actual, const std::vector<Key>& requests) {
+    ASSERT_EQ(expected.Size(), actual.Size());
+    std::vector<uint8_t> answers(requests.size());
+    actual.ContainsBatch(requests.data(), requests.size(), answers.data());
+    for (size_t i = 0; i < requests.size(); ++i) {
+        ASSERT_EQ(expected.Contains(requests[i]), actual.Contains(requests[i]));
+        ASSERT_EQ(expected.Contains(requests[i]), static_cast<bool>(answers[i]));
+        ASSERT_EQ(true, expected.IndexOf(requests[i]) == actual.IndexOf(requests[i]));
+    }
+}
+
+bool LoadFails(FixedSet& set, const std::string& path) {
+    try {
+        set.LoadFrom(path);
+    } catch (const std::runtime_error&) {
+        return true;
+    }
+    return false;
+}
+
+void SaveLoad() {
+    std::string path = "/tmp/fixed_set_test_" + std::to_string(getpid());
+    std::vector<int> elements;
+    std::vector<int> requests;
+    for (int i = 0; i < 10'000; ++i) {
+        elements.push_back(i * 3 - 5'000);
+        requests.push_back(i * 2 - 5'000);
+    }
+    FixedSet set;
+    set.Initialize(elements);
+    set.SaveTo(path);
+    FixedSet loaded;
+    loaded.LoadFrom(path);
+    ExpectSameAnswers(set, loaded, requests);
+    // Saving over a loaded file, even the loaded set itself, leaves it its own mapping.
+    FixedSet other;
+    other.Initialize({7});
+    other.SaveTo(path);
+    ExpectSameAnswers(set, loaded, requests);
+    loaded.SaveTo(path);
+    ExpectSameAnswers(set, loaded, requests);
+    FixedSet reloaded;
+    reloaded.LoadFrom(path);
+    ExpectSameAnswers(set, reloaded, requests);
+    FixedSet copy(loaded);
+    loaded.Initialize({1});
+    ExpectSameAnswers(set, copy, requests);
+    ASSERT_EQ(true, loaded.Contains(1));
+    ASSERT_EQ(false, loaded.Contains(-5'000));
+
+    FixedSet empty;
+    empty.Initialize({});
+    empty.SaveTo(path);
+    loaded.LoadFrom(path, false);
+    ExpectSameAnswers(empty, loaded, requests);
+
+    std::vector<std::string> words;
+    for (int i = 0; i < 1'000; ++i) {
+        words.push_back(std::string(i % 20, 'a') + std::to_string(i));
+    }
+    std::vector<std::string_view> word_elements(words.begin(), words.begin() + 500);
+    std::vector<std::string_view> word_requests(words.begin(), words.end());
+    BasicFixedSet<std::string_view> word_set;
+    word_set.Initialize(word_elements);
+    word_set.SaveTo(path);
+    BasicFixedSet<std::string_view> loaded_words;
+    loaded_words.LoadFrom(path);
+    ExpectSameAnswers(word_set, loaded_words, word_requests);
+    ASSERT_EQ(true, LoadFails(loaded, path));
+
+    set.SaveTo(path);
+    {
+        std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+        // Inside the bucket table, the padding is not part of the checksum.
+        file.seekg(sizeof(FixedSetFileHeader) + 200);
+        char byte = file.get();
+        file.seekp(sizeof(FixedSetFileHeader) + 200);
+        file.put(~byte);
+    }
+    ASSERT_EQ(true, LoadFails(loaded, path));
+    loaded.LoadFrom(path, false);
+    {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file << "FIXEDSET";
+    }
+    ASSERT_EQ(true, LoadFails(loaded, path));
+    std::remove(path.c_str());
+    ASSERT_EQ(true, LoadFails(loaded, path));
+}
+
+std::string ReadFile(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+void Seeded() {
+    std::string path = "/tmp/fixed_set_test_" + std::to_string(getpid());
+    std::vector<int> elements;
+    for (int i = 0; i < 300'000; ++i) {
+        elements.push_back(i * 11 - 1'000'000);
+    }
+    std::vector<std::string> layouts;
+    for (uint64_t seed : {1, 1, 2}) {
+        for (int cnt_threads : {1, 4}) {
+            FixedSet set;
+            set.Initialize(elements, cnt_threads, seed);
+            ASSERT_EQ(seed, set.GetSeed());
+            set.SaveTo(path);
+            layouts.push_back(ReadFile(path));
+            set.LoadFrom(path);
+            ASSERT_EQ(seed, set.GetSeed());
+        }
+    }
+    std::remove(path.c_str());
+    for (size_t i = 1; i < 4; ++i) {
+        ASSERT_EQ(true, layouts[0] == layouts[i]);
+    }
+    ASSERT_EQ(true, layouts[4] == layouts[5]);
+    ASSERT_EQ(false, layouts[0] == layouts[4]);
+
+    FixedSet set;
+    set.Initialize(elements);
+    FixedSet rebuilt;
+    rebuilt.Initialize(elements, 2, set.GetSeed());
+    ExpectSameAnswers(set, rebuilt, elements);
+
+    Xoshiro256 first(7);
+    Xoshiro256 second(7);
+    Xoshiro256 other(8);
+    bool same = true;
+    bool differs = false;
+    for (int i = 0; i < 100; ++i) {
+        uint64_t value = first();
+        same = same && value == second();
+        differs = differs || value != other();
+        ASSERT_EQ(true, first.Uniform(10) < 10u);
+        second.Uniform(10);
+        other.Uniform(10);
+    }
+    ASSERT_EQ(true, same);
+    ASSERT_EQ(true, differs);
+}
+
+void Stats() {
+    std::vector<int> elements;
+    for (int i = 0; i < 200'000; ++i) {
+        elements.push_back(i * 13);
+    }
+    FixedSet serial;
+    serial.Initialize(elements, 1, 5);
+    FixedSet parallel;
+    parallel.Initialize(elements, 4, 5);
+    for (const FixedSet* set : {&serial, &parallel}) {
+        const BuildStats& stats = set->GetBuildStats();
+        ASSERT_EQ(5u, stats.seed);
+        ASSERT_EQ(elements.size(), stats.cnt_keys);
+        ASSERT_EQ(true, stats.first_level_attempts >= 1);
+        ASSERT_EQ(true, stats.first_level_attempts <= stats.max_attempts);
+        ASSERT_EQ(2 * elements.size(), stats.square_sum_bound);
+        ASSERT_EQ(true, stats.square_sum <= stats.square_sum_bound);
+        size_t cnt_buckets = 0;
+        size_t cnt_keys = 0;
+        uint64_t square_sum = 0;
+        for (size_t size = 0; size < stats.bucket_size_histogram.size(); ++size) {
+            cnt_buckets += stats.bucket_size_histogram[size];
+            cnt_keys += size * stats.bucket_size_histogram[size];
+            square_sum += size * size * stats.bucket_size_histogram[size];
+        }
+        ASSERT_EQ(stats.cnt_buckets, cnt_buckets);
+        ASSERT_EQ(elements.size(), cnt_keys);
+        ASSERT_EQ(stats.square_sum, square_sum);
+        size_t cnt_hashed = cnt_buckets;
+        for (size_t size = 0; size <= 2 && size < stats.bucket_size_histogram.size(); ++size) {
+            cnt_hashed -= stats.bucket_size_histogram[size];
+        }
+        ASSERT_EQ(true, stats.second_level_attempts >= cnt_hashed);
+        ASSERT_EQ(cnt_hashed > 0, stats.max_bucket_attempts >= 1);
+        ASSERT_EQ(set->GetMemoryUsage(), stats.memory_usage);
+        ASSERT_EQ(true, stats.scratch_memory_usage > 0);
+        ASSERT_EQ(true, stats.first_level_seconds >= 0 && stats.second_level_seconds >= 0);
+    }
+    const BuildStats& lhs = serial.GetBuildStats();
+    const BuildStats& rhs = parallel.GetBuildStats();
+    ASSERT_EQ(lhs.first_level_attempts, rhs.first_level_attempts);
+    ASSERT_EQ(lhs.second_level_attempts, rhs.second_level_attempts);
+    ASSERT_EQ(lhs.max_bucket_attempts, rhs.max_bucket_attempts);
+    ASSERT_EQ(true, lhs.bucket_size_histogram == rhs.bucket_size_histogram);
+
+    serial.Initialize({});
+    ASSERT_EQ(0u, serial.GetBuildStats().cnt_keys);
+    ASSERT_EQ(0, serial.GetBuildStats().first_level_attempts);
+    ASSERT_EQ(0u, serial.GetBuildStats().bucket_size_histogram.size());
+}
+
+void Duplicates() {
+    std::vector<int> elements;
+    for (int i = 0; i < 100'000; ++i) {
+        elements.push_back(i * 7 - 300'000);
+    }
+    std::vector<int> dirty(elements);
+    dirty.push_back(elements[500]);
+    FixedSet set;
+    bool thrown = false;
+    try {
+        set.Initialize(dirty);
+    } catch (const DuplicateKeyException&) {
+        thrown = true;
+    }
+    ASSERT_EQ(true, thrown);
+
+    // Heavy repetition, including one key repeated far beyond what any hash can spread.
+    for (int i = 0; i < 50'000; ++i) {
+        dirty.push_back(elements[i % 1'000]);
+        dirty.push_back(std::numeric_limits<int>::min());
+    }
+    std::shuffle(dirty.begin(), dirty.end(), std::mt19937(3));
+    // Such a key fails the first level already, which must not pass for an unlucky input.
+    std::vector<int> skewed(elements.begin(), elements.begin() + 1'000);
+    skewed.insert(skewed.end(), 100, elements[7]);
+    for (const auto* input : {&dirty, &skewed}) {
+        for (int cnt_threads : {1, 4}) {
+            thrown = false;
+            try {
+                set.Initialize(*input, cnt_threads, 1);
+            } catch (const DuplicateKeyException&) {
+                thrown = true;
+            }
+            ASSERT_EQ(true, thrown);
+        }
+    }
+    set.SetDuplicateKeys(DuplicateKeys::kRemove);
+    for (int cnt_threads : {1, 4}) {
+        set.Initialize(dirty, cnt_threads);
+        ASSERT_EQ(elements.size() + 1, set.Size());
+        ASSERT_EQ(dirty.size() - set.Size(), set.GetBuildStats().cnt_duplicates);
+        for (int elem : elements) {
+            ASSERT_EQ(true, set.Contains(elem));
+            ASSERT_EQ(false, set.Contains(elem + 1));
+        }
+        ASSERT_EQ(true, set.Contains(std::numeric_limits<int>::min()));
+    }
+    set.Initialize(elements);
+    ASSERT_EQ(0u, set.GetBuildStats().cnt_duplicates);
+
+    BasicFixedSet<std::string_view> words;
+    words.SetDuplicateKeys(DuplicateKeys::kRemove);
+    words.Initialize({"b", "a", "b", "", "a", ""});
+    ASSERT_EQ(3u, words.Size());
+    ASSERT_EQ(true, words.Contains("") && words.Contains("a") && words.Contains("b"));
+
+    std::vector<int64_t> wide = {-5, 3, std::numeric_limits<int64_t>::min(), 3, 1LL << 40, -5};
+    std::vector<int64_t> buffer;
+    RadixSort(wide, buffer);
+    std::vector<int64_t> expected = {std::numeric_limits<int64_t>::min(), -5, -5, 3, 3,
+                                     1LL << 40};
+    ASSERT_EQ(true, wide == expected);
+}
+
+// Checks set against present, which tells for every key of [0, present.size()) whether the
+// set should hold it.
+void ExpectKeys(const FixedSet& set, const std::vector<uint8_t>& present) {
+    std::vector<int> requests(present.size());
+    std::iota(requests.begin(), requests.end(), 0);
+    std::vector<uint8_t> answers(requests.size());
+    set.ContainsBatch(requests.data(), requests.size(), answers.data());
+    size_t cnt_keys = std::count(present.begin(), present.end(), 1);
+    ASSERT_EQ(cnt_keys, set.Size());
+    std::vector<uint8_t> seen(cnt_keys, 0);
+    for (int key : requests) {
+        ASSERT_EQ(static_cast<bool>(present[key]), set.Contains(key));
+        ASSERT_EQ(present[key], answers[key]);
+        auto index = set.IndexOf(key);
+        ASSERT_EQ(static_cast<bool>(present[key]), index.has_value());
+        if (index) {
+            ASSERT_EQ(true, index.value() < cnt_keys);
+            ASSERT_EQ(0, seen[index.value()]);
+            seen[index.value()] = 1;
+        }
+    }
+}
+
+void Update() {
+    const int range = 60'000;
+    std::vector<uint8_t> present(range, 0);
+    std::vector<int> elements;
+    for (int i = 0; i < range; i += 3) {
+        elements.push_back(i);
+        present[i] = 1;
+    }
+    FixedSet set;
+    set.Initialize(elements, 1, 17);
+    std::mt19937 generator(17);
+    std::uniform_int_distribution<int> keys(0, range - 1);
+    for (int step = 0; step < 300; ++step) {
+        std::vector<int> added;
+        std::vector<int> removed;
+        for (int i = 0; i < 20; ++i) {
+            int key = keys(generator);
+            if (present[key]) {
+                removed.push_back(key);
+            } else if (std::find(added.begin(), added.end(), key) == added.end()) {
+                added.push_back(key);
+            }
+        }
+        // A key removed and added again stays, removing an absent key does nothing.
+        if (!removed.empty() && step % 2 == 0) {
+            added.push_back(removed.front());
+        }
+        removed.push_back(-1);
+        set.Update(added, removed);
+        for (int key : removed) {
+            if (key >= 0) {
+                present[key] = 0;
+            }
+        }
+        for (int key : added) {
+            present[key] = 1;
+        }
+        if (step % 50 == 0) {
+            ExpectKeys(set, present);
+        }
+        ASSERT_EQ(17u, set.GetSeed());
+    }
+    ExpectKeys(set, present);
+    const BuildStats& stats = set.GetBuildStats();
+    ASSERT_EQ(set.Size(), stats.cnt_keys);
+    ASSERT_EQ(true, stats.square_sum <= stats.square_sum_bound);
+
+    int present_key = std::find(present.begin(), present.end(), 1) - present.begin();
+    bool thrown = false;
+    try {
+        set.Update({present_key}, {});
+    } catch (const DuplicateKeyException&) {
+        thrown = true;
+    }
+    ASSERT_EQ(true, thrown);
+    thrown = false;
+    try {
+        set.Update({1, 1}, {present_key});
+    } catch (const DuplicateKeyException&) {
+        thrown = true;
+    }
+    ASSERT_EQ(true, thrown);
+    ExpectKeys(set, present);
+    set.SetDuplicateKeys(DuplicateKeys::kRemove);
+    set.Update({present_key, 1, 1}, {});
+    present[1] = 1;
+    ExpectKeys(set, present);
+
+    // Saved and loaded sets can be updated, the file stays as it was.
+    std::string path = "/tmp/fixed_set_test_" + std::to_string(getpid());
+    set.SaveTo(path);
+    FixedSet loaded;
+    loaded.LoadFrom(path);
+    int absent_key = std::find(present.begin(), present.end(), 0) - present.begin();
+    loaded.Update({absent_key}, {1});
+    std::vector<uint8_t> changed(present);
+    changed[absent_key] = 1;
+    changed[1] = 0;
+    ExpectKeys(loaded, changed);
+    loaded.LoadFrom(path);
+    ExpectKeys(loaded, present);
+    std::remove(path.c_str());
+
+    // Down to nothing and back again.
+    std::vector<int> all;
+    for (int key = 0; key < range; ++key) {
+        if (present[key]) {
+            all.push_back(key);
+        }
+    }
+    set.Update({}, all);
+    ExpectKeys(set, std::vector<uint8_t>(range, 0));
+    set.Update({5, 7}, {});
+    std::vector<uint8_t> two(range, 0);
+    two[5] = two[7] = 1;
+    ExpectKeys(set, two);
+
+    std::vector<std::string> words = {"alpha", "beta", "gamma", "delta", "epsilon"};
+    BasicFixedSet<std::string_view> strings;
+    strings.Initialize({words[0], words[1], words[2]});
+    std::string added = "zeta";
+    strings.Update({added, words[3]}, {words[1]});
+    added = "none";
+    for (std::string_view word : {"alpha", "gamma", "delta", "zeta"}) {
+        ASSERT_EQ(true, strings.Contains(word));
+    }
+    for (std::string_view word : {"beta", "epsilon", "none"}) {
+        ASSERT_EQ(false, strings.Contains(word));
+    }
+    ASSERT_EQ(4u, strings.Size());
+}
+
+// Snapshot g holds the keys [0, 100 g), so every batch answered from one snapshot is a run
+// of ones followed by zeros.
+void Concurrent() {
+    const int cnt_generations = 40;
+    const int range = 100 * (cnt_generations + 1);
+    ConcurrentFixedSet set(4);
+    std::atomic<bool> done{false};
+    std::atomic<int> cnt_failures{0};
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 3; ++t) {
+        readers.emplace_back([&] {
+            ConcurrentFixedSet::Reader reader = set.GetReader();
+            std::vector<int> requests(range);
+            std::iota(requests.begin(), requests.end(), 0);
+            std::vector<uint8_t> answers(range);
+            while (!done.load()) {
+                reader.ContainsBatch(requests.data(), range, answers.data());
+                size_t ones = std::find(answers.begin(), answers.end(), 0) - answers.begin();
+                if (ones % 100 != 0 || std::count(answers.begin(), answers.end(), 1) !=
+                                           static_cast<ptrdiff_t>(ones)) {
+                    ++cnt_failures;
+                }
+                if (reader.Contains(-1) || reader.Size() % 100 != 0) {
+                    ++cnt_failures;
+                }
+            }
+        });
+    }
+    std::vector<int> elements;
+    for (int g = 1; g <= cnt_generations; ++g) {
+        std::vector<int> block;
+        for (int key = 100 * (g - 1); key < 100 * g; ++key) {
+            block.push_back(key);
+        }
+        elements.insert(elements.end(), block.begin(), block.end());
+        if (g % 2 == 0) {
+            set.Update(block, {});
+        } else {
+            set.Initialize(elements);
+        }
+    }
+    done.store(true);
+    for (std::thread& reader : readers) {
+        reader.join();
+    }
+    ASSERT_EQ(0, cnt_failures.load());
+    ASSERT_EQ(0u, set.GetRetiredCount());
+
+    ConcurrentFixedSet::Reader reader = set.GetReader();
+    ASSERT_EQ(elements.size(), reader.Size());
+    ASSERT_EQ(true, reader.IndexOf(5).has_value());
+    std::vector<ConcurrentFixedSet::Reader> more;
+    bool thrown = false;
+    try {
+        for (int i = 0; i < 4; ++i) {
+            more.push_back(set.GetReader());
+        }
+    } catch (const std::length_error&) {
+        thrown = true;
+    }
+    ASSERT_EQ(true, thrown);
+    ASSERT_EQ(3u, more.size());
+}
+
+void Sharded() {
+    ASSERT_EQ(true, NumaTopology::ParseCpuList("0-3,8,10-11") ==
+                    std::vector<int>({0, 1, 2, 3, 8, 10, 11}));
+    ASSERT_EQ(true, NumaTopology::ParseCpuList("5\n") == std::vector<int>({5}));
+    ShardedFixedSet by_node;
+    ASSERT_EQ(NumaTopology().GetNodeCount(), by_node.GetShardCount());
+    ASSERT_EQ(false, by_node.Contains(0));
+
+    std::vector<int> elements;
+    std::vector<int> requests;
+    for (int i = 0; i < 100'000; ++i) {
+        elements.push_back(i * 4 - 200'000);
+        requests.push_back(i * 2 - 200'000);
+    }
+    ShardedFixedSet set(4);
+    set.Initialize(elements, 2, 11);
+    ASSERT_EQ(elements.size(), set.Size());
+    std::vector<size_t> shard_sizes(4, 0);
+    for (int elem : elements) {
+        ++shard_sizes[set.GetShard(elem)];
+    }
+    for (size_t s = 0; s < 4; ++s) {
+        ASSERT_EQ(shard_sizes[s], set.GetShardSet(s).Size());
+        ASSERT_EQ(true, shard_sizes[s] > elements.size() / 8);
+        ASSERT_EQ(true, set.GetNode(s) < NumaTopology().GetNodeCount());
+    }
+    std::vector<uint8_t> answers(requests.size());
+    set.ContainsBatch(requests.data(), requests.size(), answers.data());
+    std::vector<uint8_t> seen(elements.size(), 0);
+    for (size_t i = 0; i < requests.size(); ++i) {
+        bool expected = i % 2 == 0;
+        ASSERT_EQ(expected, set.Contains(requests[i]));
+        ASSERT_EQ(expected, static_cast<bool>(answers[i]));
+        auto index = set.IndexOf(requests[i]);
+        ASSERT_EQ(expected, index.has_value());
+        if (index) {
+            ASSERT_EQ(0, seen[index.value()]);
+            seen[index.value()] = 1;
+        }
+    }
+
+    std::vector<std::string> words = {"north", "south", "east", "west"};
+    BasicShardedFixedSet<std::string_view> strings(3);
+    strings.Initialize({words[0], words[1], words[2]});
+    ASSERT_EQ(true, strings.Contains("south"));
+    ASSERT_EQ(false, strings.Contains(words[3]));
+}
+
+void HugePages() {
+    HugePageAllocator<int> allocator;
+    for (size_t n : {1, 1'000, 1'000'000}) {
+        int* data = allocator.allocate(n);
+        ASSERT_EQ(0u, reinterpret_cast<uintptr_t>(data) % HugePageAllocator<int>::kAlignment);
+        if (n * sizeof(int) >= HugePageAllocator<int>::kHugePage) {
+            ASSERT_EQ(0u, reinterpret_cast<uintptr_t>(data) % HugePageAllocator<int>::kHugePage);
+        }
+        data[0] = data[n - 1] = 7;
+        allocator.deallocate(data, n);
+    }
+
+    std::vector<int> elements;
+    std::vector<int> requests;
+    for (int i = 0; i < 300'000; ++i) {
+        elements.push_back(i * 5 - 700'000);
+        requests.push_back(i * 5 / 2 - 700'000);
+    }
+    using AlignedSet = BasicFixedSet<int, LinearHashPolicy, HugePageAllocation<64>>;
+    AlignedSet aligned;
+    aligned.Initialize(elements, 2, 3);
+    BasicFixedSet<int, LinearHashPolicy, HugePageAllocation<>> huge;
+    huge.Initialize(elements, 2, 3);
+    FixedSet plain;
+    plain.Initialize(elements, 2, 3);
+    ASSERT_EQ(plain.GetMemoryUsage(), huge.GetMemoryUsage());
+    auto expect_plain = [&](const auto& set) {
+        ASSERT_EQ(plain.Size(), set.Size());
+        std::vector<uint8_t> answers(requests.size());
+        set.ContainsBatch(requests.data(), requests.size(), answers.data());
+        for (size_t i = 0; i < requests.size(); ++i) {
+            ASSERT_EQ(plain.Contains(requests[i]), set.Contains(requests[i]));
+            ASSERT_EQ(plain.Contains(requests[i]), static_cast<bool>(answers[i]));
+            ASSERT_EQ(true, plain.IndexOf(requests[i]) == set.IndexOf(requests[i]));
+        }
+    };
+    expect_plain(huge);
+    expect_plain(aligned);
+
+    // Padded records change the file layout, so only the same policy reads it back.
+    std::string path = "/tmp/fixed_set_test_" + std::to_string(getpid());
+    aligned.SaveTo(path);
+    AlignedSet loaded;
+    loaded.LoadFrom(path);
+    ASSERT_EQ(true, loaded.Contains(elements[10]));
+    ASSERT_EQ(true, LoadFails(plain, path));
+    std::remove(path.c_str());
+}
+
+// Reduces into the lower half of any table wider than 64, the expected first-level sum of
+// squares on an exact-size table is then about 3n and the search has to grow the table.
+struct SkewedHashPolicy : LinearHashPolicy {
+    static uint32_t Reduce(uint32_t hash, uint32_t cnt_buckets) noexcept {
+        return LinearHashPolicy::Reduce(hash, cnt_buckets > 64 ? cnt_buckets / 2 : cnt_buckets);
+    }
+};
+
+void AdaptiveRetry() {
+    std::vector<int> elements;
+    for (int i = 0; i < 50'000; ++i) {
+        elements.push_back(i * 17 - 400'000);
+    }
+    FixedSet plain;
+    plain.Initialize(elements, 1, 9);
+    ASSERT_EQ(true, plain.GetBuildStats().cnt_buckets >= elements.size());
+    ASSERT_EQ(elements.size(), plain.Size());
+
+    BasicFixedSet<int, SkewedHashPolicy> serial;
+    serial.Initialize(elements, 1, 9);
+    BasicFixedSet<int, SkewedHashPolicy> parallel;
+    parallel.Initialize(elements, 4, 9);
+    for (const auto* set : {&serial, &parallel}) {
+        const BuildStats& stats = set->GetBuildStats();
+        ASSERT_EQ(true, stats.cnt_buckets > elements.size());
+        ASSERT_EQ(true, stats.cnt_buckets <= 2 * elements.size());
+        ASSERT_EQ(true, stats.first_level_attempts > 8);
+        ASSERT_EQ(true, stats.square_sum <= stats.square_sum_bound);
+        ASSERT_EQ(elements.size(), set->Size());
+        for (size_t i = 0; i < elements.size(); ++i) {
+            ASSERT_EQ(true, set->Contains(elements[i]));
+            ASSERT_EQ(true, set->IndexOf(elements[i]).has_value());
+            ASSERT_EQ(false, set->Contains(elements[i] + 1));
+        }
+    }
+    ASSERT_EQ(serial.GetBuildStats().cnt_buckets, parallel.GetBuildStats().cnt_buckets);
+    ASSERT_EQ(serial.GetBuildStats().first_level_attempts,
+              parallel.GetBuildStats().first_level_attempts);
+}
+
+// Sends every key to the first bucket, no table size helps.
+struct CollapsedHashPolicy : LinearHashPolicy {
+    static uint32_t Reduce(uint32_t, uint32_t) noexcept {
+        return 0;
+    }
+};
+
+void GrowthCap() {
+    std::vector<int> elements(1'000);
+    std::iota(elements.begin(), elements.end(), 0);
+    for (int cnt_threads : {1, 4}) {
+        BasicFixedSet<int, CollapsedHashPolicy> set;
+        bool thrown = false;
+        try {
+            set.Initialize(elements, cnt_threads, 3);
+        } catch (const BadHashFunctionException&) {
+            thrown = true;
+        }
+        ASSERT_EQ(true, thrown);
+    }
+    std::string path = "/tmp/fixed_set_cap_" + std::to_string(getpid());
+    BasicFixedSetFileBuilder<int, CollapsedHashPolicy> builder;
+    KeyRangeSource source(elements.begin(), elements.end());
+    bool thrown = false;
+    try {
+        builder.Build(source, path, 1, 3);
+    } catch (const BadHashFunctionException&) {
+        thrown = true;
+    }
+    ASSERT_EQ(true, thrown);
+    ASSERT_EQ(false, static_cast<bool>(std::ifstream(path)));
+}
+
+// Spreads keys over at most 64 buckets, so much larger sets cannot be built.
+struct NarrowHashPolicy : LinearHashPolicy {
+    static uint32_t Reduce(uint32_t hash, uint32_t cnt_buckets) noexcept {
+        return LinearHashPolicy::Reduce(hash, std::min<uint32_t>(cnt_buckets, 64));
+    }
+};
+
+void UpdateRollback() {
+    std::vector<int> elements;
+    for (int i = 0; i < 50; ++i) {
+        elements.push_back(i * 3);
+    }
+    std::vector<int> added(1'000);
+    std::iota(added.begin(), added.end(), 1'000);
+    BasicFixedSet<int, NarrowHashPolicy> set;
+    set.Initialize(elements, 1, 5);
+    bool thrown = false;
+    try {
+        set.Update(added, {elements[0]});
+    } catch (const BadHashFunctionException&) {
+        thrown = true;
+    }
+    ASSERT_EQ(true, thrown);
+    ASSERT_EQ(elements.size(), set.Size());
+    for (int elem : elements) {
+        ASSERT_EQ(true, set.Contains(elem));
+    }
+    ASSERT_EQ(false, set.Contains(added[0]));
+    set.Update({1}, {elements[0]});
+    ASSERT_EQ(true, set.Contains(1));
+    ASSERT_EQ(false, set.Contains(elements[0]));
+}
+
+void Prefilter() {
+    Xoshiro256 generator(25);
+    for (size_t n : {1, 2, 3, 10, 1'000, 100'000}) {
+        std::vector<uint64_t> hashes(n);
+        for (uint64_t& hash : hashes) {
+            hash = generator();
+        }
+        BinaryFuseFilter filter;
+        uint64_t seed = 0;
+        while (!filter.Build(hashes, seed)) {
+            ++seed;
+        }
+        ASSERT_EQ(seed, filter.GetSeed());
+        for (uint64_t hash : hashes) {
+            ASSERT_EQ(true, filter.Contains(hash));
+        }
+        if (n == 100'000) {
+            ASSERT_EQ(true, filter.GetMemoryUsage() * 8 < n * 10);
+            size_t cnt_false_positives = 0;
+            for (size_t i = 0; i < n; ++i) {
+                cnt_false_positives += filter.Contains(generator());
+            }
+            ASSERT_EQ(true, cnt_false_positives < n / 100);
+        }
+    }
+
+    std::vector<int> elements;
+    std::vector<int> requests;
+    for (int i = 0; i < 200'000; ++i) {
+        elements.push_back(i * 7 - 600'000);
+        requests.push_back(i * 3 - 600'000);
+    }
+    FixedSet plain;
+    plain.Initialize(elements, 1, 5);
+    FixedSet filtered;
+    filtered.SetPrefilter(true);
+    filtered.Initialize(elements, 2, 5);
+    ExpectSameAnswers(plain, filtered, requests);
+    ASSERT_EQ(true, (filtered.GetMemoryUsage() - plain.GetMemoryUsage()) * 8 <
+                    elements.size() * 10);
+
+    std::vector<int> added;
+    std::vector<int> removed;
+    for (int i = 0; i < 1'000; ++i) {
+        added.push_back(i * 7 - 600'001);
+        removed.push_back(elements[i * 100]);
+    }
+    plain.Update(added, removed);
+    filtered.Update(added, removed);
+    ExpectSameAnswers(plain, filtered, requests);
+    ExpectSameAnswers(plain, filtered, added);
+    ExpectSameAnswers(plain, filtered, removed);
+
+    std::string path = "/tmp/fixed_set_test_" + std::to_string(getpid());
+    filtered.SaveTo(path);
+    FixedSet loaded;
+    loaded.LoadFrom(path);
+    ExpectSameAnswers(plain, loaded, requests);
+    std::remove(path.c_str());
+    plain.Update(removed, added);
+    loaded.Update(removed, added);
+    ExpectSameAnswers(plain, loaded, requests);
+    ExpectSameAnswers(plain, loaded, added);
+    ExpectSameAnswers(plain, loaded, removed);
+
+    std::vector<std::string> words;
+    for (int i = 0; i < 2'000; ++i) {
+        words.push_back("key" + std::to_string(i * 13));
+    }
+    std::vector<std::string_view> word_elements(words.begin(), words.begin() + 1'000);
+    std::vector<std::string_view> word_requests(words.begin(), words.end());
+    BasicFixedSet<std::string_view> word_plain;
+    word_plain.Initialize(word_elements, 1, 7);
+    BasicFixedSet<std::string_view> word_filtered;
+    word_filtered.SetPrefilter(true);
+    word_filtered.Initialize(word_elements, 1, 7);
+    ExpectSameAnswers(word_plain, word_filtered, word_requests);
+}
+
+void StaticSet() {
+    constexpr auto kOpcodes = MakeFixedSet<0x01, 0x0f, 0x3c, -7, 1'000'000'000>();
+    static_assert(kOpcodes.Contains(0x0f) && kOpcodes.Contains(-7) && !kOpcodes.Contains(2));
+    static_assert(kOpcodes.Size() == 5 && !MakeFixedSet<>().Contains(0));
+
+    constexpr auto kSquares = MakeFixedSet([] {
+        std::array<int, 2'000> keys = {};
+        for (int i = 0; i < 2'000; ++i) {
+            keys[i] = i * i - 1'000'000;
+        }
+        return keys;
+    }());
+    static_assert(kSquares.Contains(44 * 44 - 1'000'000) && !kSquares.Contains(-999'998));
+    std::vector<int> elements;
+    for (int i = 0; i < 2'000; ++i) {
+        elements.push_back(i * i - 1'000'000);
+    }
+    FixedSet set;
+    set.Initialize(elements);
+    for (int key = -1'000'100; key < 3'000'000; key += 7) {
+        ASSERT_EQ(set.Contains(key), kSquares.Contains(key));
+    }
+    for (int key : elements) {
+        ASSERT_EQ(true, kSquares.Contains(key));
+    }
+    ASSERT_EQ(true, MakeFixedSet(std::array<int, 3>{4, 5, 6}, 17).Contains(5));
+}
+
+void LookupCounters() {
+    std::vector<int> elements;
+    for (int i = 0; i < 20'000; ++i) {
+        elements.push_back(i * 9 - 90'000);
+    }
+    InstrumentedFixedSet set;
+    set.Initialize(elements, 1, 4);
+    FixedSet plain;
+    plain.Initialize(elements, 1, 4);
+    std::vector<int> requests;
+    for (int key = -100'000; key < 100'000; key += 4) {
+        requests.push_back(key);
+    }
+    uint64_t cnt_hits = 0;
+    for (int key : requests) {
+        ASSERT_EQ(plain.Contains(key), set.Contains(key));
+        ASSERT_EQ(true, plain.IndexOf(key) == set.IndexOf(key));
+        cnt_hits += plain.Contains(key);
+    }
+    LookupStatsSnapshot stats = set.GetLookupStats();
+    ASSERT_EQ(2 * requests.size(), stats.lookups);
+    ASSERT_EQ(2 * cnt_hits, stats.hits);
+    ASSERT_EQ(0u, stats.filtered);
+    ASSERT_EQ(stats.lookups, stats.empty_bucket + stats.scanned_bucket + stats.hashed_bucket);
+    ASSERT_EQ(true, stats.empty_bucket > 0 && stats.scanned_bucket > 0);
+    ASSERT_EQ((stats.lookups + LookupStats::kSamplePeriod - 1) / LookupStats::kSamplePeriod,
+              stats.sampled);
+    ASSERT_EQ(stats.sampled, std::accumulate(stats.latency.begin(), stats.latency.end(),
+                                             static_cast<uint64_t>(0)));
+    ASSERT_EQ(true, stats.GetLatencyQuantile(0.5) <= stats.GetLatencyQuantile(0.99));
+
+    set.ResetLookupStats();
+    set.SetPrefilter(true);
+    set.Initialize(elements, 1, 4);
+    std::vector<uint8_t> answers(requests.size());
+    std::vector<uint8_t> other_answers(requests.size());
+    std::thread other([&] {
+        set.ContainsBatch(requests.data(), requests.size(), other_answers.data());
+    });
+    set.ContainsBatch(requests.data(), requests.size(), answers.data());
+    other.join();
+    stats = set.GetLookupStats();
+    ASSERT_EQ(2 * requests.size(), stats.lookups);
+    ASSERT_EQ(2 * cnt_hits, stats.hits);
+    ASSERT_EQ(true, stats.filtered > stats.lookups / 2);
+    ASSERT_EQ(stats.lookups,
+              stats.filtered + stats.empty_bucket + stats.scanned_bucket + stats.hashed_bucket);
+    // Update looks keys up too, but those are not queries.
+    set.Update({1, 2, 3}, {elements[0], elements[1], 4});
+    ASSERT_EQ(stats.lookups, set.GetLookupStats().lookups);
+    ASSERT_EQ(stats.sampled, set.GetLookupStats().sampled);
+
+    LookupStatsSnapshot total = stats;
+    total += stats;
+    ASSERT_EQ(2 * stats.hits, total.hits);
+    std::ostringstream out;
+    total.Print(out);
+    ASSERT_EQ(true, out.str().find("hits " + std::to_string(total.hits) + "\n") !=
+                    std::string::npos);
+}
+
+void ParallelRequests() {
+    std::vector<int> elements;
+    std::vector<int> requests;
+    for (int i = 0; i < 50'000; ++i) {
+        elements.push_back(i * 5);
+        requests.push_back(i * 3);
+    }
+    FixedSet set;
+    set.Initialize(elements);
+    std::string path = "/tmp/fixed_set_test_" + std::to_string(getpid());
+    auto output = [&](auto perform) {
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        {
+            OutputWriter writer(fd);
+            perform(writer);
+            writer.Flush();
+        }
+        close(fd);
+        return ReadFile(path);
+    };
+    std::string expected = output([&](OutputWriter& writer) {
+        PerformRequests(requests, set, writer);
+    });
+    ASSERT_EQ(requests.size() * 3 + requests.size() / 5, expected.size());
+    for (int cnt_threads : {1, 3, 8}) {
+        for (size_t cnt_requests : {0, 1, 4'096, 4'097, 50'000}) {
+            std::vector<int> prefix(requests.begin(), requests.begin() + cnt_requests);
+            std::string actual = output([&](OutputWriter& writer) {
+                PerformRequestsParallel(prefix, set, writer, cnt_threads);
+            });
+            size_t length = 0;
+            for (size_t i = 0; i < cnt_requests; ++i) {
+                length += requests[i] % 5 == 0 ? 4 : 3;
+            }
+            ASSERT_EQ(expected.substr(0, length), actual);
+        }
+    }
+    std::remove(path.c_str());
+}
+
+// Updates go through the inline copies too: keys of emptied buckets, the key of the shared
+// slot among them, must not be found in the copies left behind.
+void CoLocated() {
+    std::vector<int> elements;
+    std::vector<int> requests;
+    for (int i = 0; i < 200'000; ++i) {
+        elements.push_back(i * 7 + 3);
+        requests.push_back(i * 7 / 3 + 3);
+    }
+    CoLocatedFixedSet colocated;
+    colocated.Initialize(elements, 2, 5);
+    FixedSet plain;
+    plain.Initialize(elements, 2, 5);
+    auto expect_plain = [&](const auto& set) {
+        ASSERT_EQ(plain.Size(), set.Size());
+        std::vector<uint8_t> answers(requests.size());
+        set.ContainsBatch(requests.data(), requests.size(), answers.data());
+        for (size_t i = 0; i < requests.size(); ++i) {
+            ASSERT_EQ(plain.Contains(requests[i]), set.Contains(requests[i]));
+            ASSERT_EQ(plain.Contains(requests[i]), static_cast<bool>(answers[i]));
+            ASSERT_EQ(true, plain.IndexOf(requests[i]) == set.IndexOf(requests[i]));
+        }
+    };
+    expect_plain(colocated);
+
+    // Few enough changes to be made in place instead of by a rebuild.
+    std::vector<int> removed;
+    for (size_t i = 0; i < elements.size(); i += 50) {
+        removed.push_back(elements[i]);
+    }
+    std::vector<int> added = {-1, -8, 1'000'000'007};
+    colocated.Update(added, removed);
+    plain.Update(added, removed);
+    requests.insert(requests.end(), added.begin(), added.end());
+    expect_plain(colocated);
+    colocated.Update({}, {elements.back(), -8});
+    plain.Update({}, {elements.back(), -8});
+    expect_plain(colocated);
+
+    for (uint64_t seed = 0; seed < 20; ++seed) {
+        CoLocatedFixedSet tiny;
+        tiny.Initialize({10, 20, 30, 40}, 1, seed);
+        tiny.Update({}, {10});
+        ASSERT_EQ(false, tiny.Contains(10));
+        ASSERT_EQ(true, tiny.Contains(20) && tiny.Contains(30) && tiny.Contains(40));
+        std::vector<int> keys = {10, 20, 30, 40};
+        std::vector<uint8_t> answers(keys.size());
+        tiny.ContainsBatch(keys.data(), keys.size(), answers.data());
+        ASSERT_EQ(true, answers == std::vector<uint8_t>({0, 1, 1, 1}));
+    }
+
+    std::string path = "/tmp/fixed_set_test_" + std::to_string(getpid());
+    colocated.SaveTo(path);
+    CoLocatedFixedSet loaded;
+    loaded.LoadFrom(path);
+    expect_plain(loaded);
+    std::remove(path.c_str());
+
+    std::vector<std::string> words;
+    for (int i = 0; i < 5'000; ++i) {
+        words.push_back("word" + std::to_string(i * 3));
+    }
+    std::vector<std::string_view> word_elements(words.begin(), words.end());
+    BasicFixedSet<std::string_view, StringHashPolicy, AlignedAllocation<64>> strings;
+    strings.Initialize(word_elements, 1, 9);
+    for (int i = 0; i < 15'000; ++i) {
+        ASSERT_EQ(i % 3 == 0, strings.Contains("word" + std::to_string(i)));
+    }
+}
+
+// A file built out of core answers as the set built in memory from the same keys and seed.
+void ExternalBuild() {
+    std::string path = "/tmp/fixed_set_test_" + std::to_string(getpid());
+    std::vector<int> elements;
+    std::vector<int> requests;
+    for (int i = 0; i < 300'000; ++i) {
+        elements.push_back(static_cast<int>(i * 2'654'435'761u) / 2);
+        requests.push_back(static_cast<int>((i / 2) * 2'654'435'761u) / 2 + i % 2);
+    }
+    const size_t memory_limit = 1 << 22;
+    FixedSetFileBuilder builder(memory_limit);
+    KeyRangeSource source(elements.begin(), elements.end());
+    builder.Build(source, path, 2, 11);
+    ASSERT_EQ(true, builder.GetPartitionCount() > 4);
+    FixedSet expected;
+    expected.Initialize(elements, 1, 11);
+    FixedSet loaded;
+    loaded.LoadFrom(path);
+    ASSERT_EQ(11u, loaded.GetSeed());
+    ExpectSameAnswers(expected, loaded, requests);
+    const BuildStats& stats = builder.GetBuildStats();
+    const BuildStats& expected_stats = expected.GetBuildStats();
+    ASSERT_EQ(expected_stats.cnt_keys, stats.cnt_keys);
+    ASSERT_EQ(expected_stats.cnt_buckets, stats.cnt_buckets);
+    ASSERT_EQ(expected_stats.first_level_attempts, stats.first_level_attempts);
+    ASSERT_EQ(expected_stats.square_sum, stats.square_sum);
+    ASSERT_EQ(expected_stats.second_level_attempts, stats.second_level_attempts);
+    ASSERT_EQ(true, expected_stats.bucket_size_histogram == stats.bucket_size_histogram);
+    ASSERT_EQ(true, stats.scratch_memory_usage <= memory_limit);
+
+    // Loaded files are updated like saved ones, the padding slots are never looked at.
+    std::vector<int> removed(elements.begin(), elements.begin() + 1'000);
+    std::vector<int> added = {1, 2, 3};
+    expected.Update(added, removed);
+    loaded.Update(added, removed);
+    ExpectSameAnswers(expected, loaded, requests);
+
+    // Raw keys from a stream, repeated ones removed as Initialize removes them.
+    std::vector<int> repeated(elements.begin(), elements.begin() + 50'000);
+    repeated.insert(repeated.end(), elements.begin() + 10'000, elements.begin() + 30'000);
+    std::stringstream stream;
+    stream.write(reinterpret_cast<const char*>(repeated.data()), repeated.size() * sizeof(int));
+    KeyStreamSource<int> stream_source(stream);
+    builder.SetDuplicateKeys(DuplicateKeys::kRemove);
+    builder.Build(stream_source, path, 1, 3);
+    expected.SetDuplicateKeys(DuplicateKeys::kRemove);
+    expected.Initialize(repeated, 1, 3);
+    loaded.LoadFrom(path);
+    ExpectSameAnswers(expected, loaded, requests);
+    ASSERT_EQ(20'000u, builder.GetBuildStats().cnt_duplicates);
+
+    // The set may replace the file its keys come from.
+    {
+        std::ofstream raw(path, std::ios::binary | std::ios::trunc);
+        raw.write(reinterpret_cast<const char*>(repeated.data()), repeated.size() * sizeof(int));
+    }
+    std::ifstream raw(path, std::ios::binary);
+    KeyStreamSource<int> file_source(raw);
+    builder.Build(file_source, path, 1, 3);
+    loaded.LoadFrom(path);
+    ExpectSameAnswers(expected, loaded, requests);
+
+    // Rejected duplicates leave the previous file, and the set loaded from it, alone.
+    builder.SetDuplicateKeys(DuplicateKeys::kReject);
+    KeyRangeSource repeated_source(repeated.begin(), repeated.end());
+    bool thrown = false;
+    try {
+        builder.Build(repeated_source, path, 1, 3);
+    } catch (const DuplicateKeyException&) {
+        thrown = true;
+    }
+    ASSERT_EQ(true, thrown);
+    ExpectSameAnswers(expected, loaded, requests);
+    FixedSet previous;
+    previous.LoadFrom(path);
+    ExpectSameAnswers(expected, previous, requests);
+    std::vector<int> skewed(elements.begin(), elements.begin() + 1'000);
+    skewed.insert(skewed.end(), 100, elements[7]);
+    KeyRangeSource skewed_source(skewed.begin(), skewed.end());
+    thrown = false;
+    try {
+        builder.Build(skewed_source, path, 1, 1);
+    } catch (const DuplicateKeyException&) {
+        thrown = true;
+    }
+    ASSERT_EQ(true, thrown);
+
+    std::vector<int> none;
+    KeyRangeSource empty_source(none.begin(), none.end());
+    builder.Build(empty_source, path, 1, 3);
+    loaded.LoadFrom(path);
+    ASSERT_EQ(0u, loaded.Size());
+    ASSERT_EQ(false, loaded.Contains(0));
+
+    BasicFixedSetFileBuilder<int, LinearHashPolicy, AlignedAllocation<64>> aligned(memory_limit);
+    KeyRangeSource aligned_source(elements.begin(), elements.end());
+    aligned.Build(aligned_source, path, 1, 5);
+    CoLocatedFixedSet colocated;
+    colocated.LoadFrom(path);
+    CoLocatedFixedSet colocated_expected;
+    colocated_expected.Initialize(elements, 1, 5);
+    ExpectSameAnswers(colocated_expected, colocated, requests);
+    std::remove(path.c_str());
+}
+
+void Compact() {
+    CompactFixedSet set;
+    set.Initialize({});
+    ASSERT_EQ(false, set.Contains(0));
+    for (int elements_count : {1, 2, 10, 1'000, 100'000}) {
+        std::vector<int> elements;
+        for (int i = 0; i < elements_count; ++i) {
+            elements.push_back(i * 5 - 250'000);
+        }
+        set.Initialize(elements);
+        for (auto elem : elements) {
+            ASSERT_EQ(true, set.Contains(elem));
+            ASSERT_EQ(false, set.Contains(elem + 1));
+        }
+        ASSERT_EQ(false, set.Contains(-250'005));
+    }
+    FixedSet fixed_set;
+    std::vector<int> elements(100'000);
+    std::iota(elements.begin(), elements.end(), 0);
+    fixed_set.Initialize(elements);
+    ASSERT_EQ(true, set.GetBytesPerKey() < 6);
+    ASSERT_EQ(true, set.GetBytesPerKey() < fixed_set.GetBytesPerKey());
+
+    // A rejected input leaves the set as it was.
+    double bytes_per_key = set.GetBytesPerKey();
+    std::vector<int> dirty = {5, 1, 9, 1};
+    bool thrown = false;
+    try {
+        set.Initialize(dirty);
+    } catch (const DuplicateKeyException&) {
+        thrown = true;
+    }
+    ASSERT_EQ(true, thrown);
+    ASSERT_EQ(bytes_per_key, set.GetBytesPerKey());
+    ASSERT_EQ(true, set.Contains(-250'000));
+    ASSERT_EQ(false, set.Contains(1));
+}
+
 void Magic() {
 #ifdef MAGIC
     std::cerr << "You've been visited by Hash Police!\n";
@@ -123,6 +1809,39 @@ void RunTests() {
     Empty();
     Simple();
     RepeatInitialize();
+    Dense();
+    Big();
+    ParallelInitialize();
+    SharedArena();
+    IndexOf();
+    Batch();
+    SmallBuckets();
+    BatchExtremes();
+    MultiplyShift();
+    WideKeys();
+    StringKeys();
+    Reader();
+    Writer();
+    Ring();
+    Stream();
+    SaveLoad();
+    Seeded();
+    Stats();
+    Duplicates();
+    Update();
+    Concurrent();
+    Sharded();
+    HugePages();
+    AdaptiveRetry();
+    GrowthCap();
+    UpdateRollback();
+    Prefilter();
+    StaticSet();
+    LookupCounters();
+    ParallelRequests();
+    CoLocated();
+    ExternalBuild();
+    Compact();
     Magic();
     std::cerr << "Tests are passed!\n";
 }
@@ -0,0 +1,264 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
+
+#include "fixed_set.h"
+
+// NUMA nodes of the machine and their CPUs, as listed in /sys/devices/system/node. Where
+// that is unavailable the machine is one node holding every CPU.
+class NumaTopology {
+    std::vector<std::vector<int>> cpus_;
+
+public:
+    NumaTopology() {
+        for (int node = 0;; ++node) {
+            std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) +
+                               "/cpulist");
+            std::string list;
+            if (!file || !std::getline(file, list)) {
+                break;
+            }
+            cpus_.push_back(ParseCpuList(list));
+        }
+        if (cpus_.empty()) {
+            cpus_.emplace_back();
+            for (unsigned cpu = 0; cpu < std::max(1u, std::thread::hardware_concurrency());
+                 ++cpu) {
+                cpus_.back().push_back(cpu);
+            }
+        }
+    }
+
+    // Reads the kernel's CPU list format, e.g. "0-3,8,10-11".
+    static std::vector<int> ParseCpuList(const std::string& list) {
+        std::vector<int> cpus;
+        size_t pos = 0;
+        while (pos < list.size() && std::isdigit(static_cast<unsigned char>(list[pos]))) {
+            size_t end;
+            int first = std::stoi(list.substr(pos), &end);
+            pos += end;
+            int last = first;
+            if (pos < list.size() && list[pos] == '-') {
+                last = std::stoi(list.substr(pos + 1), &end);
+                pos += end + 1;
+            }
+            for (int cpu = first; cpu <= last; ++cpu) {
+                cpus.push_back(cpu);
+            }
+            if (pos < list.size() && list[pos] == ',') {
+                ++pos;
+            }
+        }
+        return cpus;
+    }
+
+    size_t GetNodeCount() const noexcept {
+        return cpus_.size();
+    }
+
+    const std::vector<int>& GetCpus(size_t node) const noexcept {
+        return cpus_[node];
+    }
+
+    // Restricts the calling thread, and the threads it starts from now on, to the CPUs of
+    // node. Does nothing for a node without CPUs.
+    void PinToNode(size_t node) const {
+        if (cpus_[node].empty()) {
+            return;
+        }
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu: cpus_[node]) {
+            CPU_SET(cpu, &set);
+        }
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+};
+
+// FixedSet split into independent shards by the high bits of a hash of the key, so that
+// each shard can live on its own NUMA node. Shard s belongs to node s mod the node count
+// and is built by a thread pinned to that node. Linux places pages on the node of the
+// thread that first touches them, so every shard ends up in node-local memory without
+// depending on libnuma. Threads serving lookups are best pinned to the same nodes and
+// sent the keys of their shards, GetShard and GetNode tell where a key lives.
+template <class Key = int, class HashPolicy = typename DefaultHashPolicy<Key>::Type>
+class BasicShardedFixedSet {
+public:
+    using Set = BasicFixedSet<Key, HashPolicy>;
+    static constexpr size_t kMaxShards = 64;
+
+private:
+    using HashFunction = typename HashPolicy::HashFunction;
+    using Generator = typename HashPolicy::Generator;
+
+    // ContainsBatch routes keys to shards in chunks of this many.
+    static constexpr size_t kRouteChunk = 256;
+
+    NumaTopology topology_;
+    std::optional<HashFunction> hash_;
+    std::vector<Set> shards_;
+    // offsets_[s] is the number of keys in shards before s, it shifts the indices of
+    // IndexOf to make them dense over the whole set.
+    std::vector<uint32_t> offsets_;
+
+    // The shard hash is drawn from the same family as the shards' own ones, but
+    // independently, and mixed so that its high bits do not follow theirs.
+    size_t GetShard(const HashFunction& hash, const Key& number) const noexcept {
+        uint64_t mixed = SplitMix64(hash.GetHash(number));
+        return ((mixed >> 32) * shards_.size()) >> 32;
+    }
+
+public:
+    // cnt_shards = 0 takes one shard per NUMA node.
+    explicit BasicShardedFixedSet(size_t cnt_shards = 0) {
+        if (cnt_shards == 0) {
+            cnt_shards = topology_.GetNodeCount();
+        }
+        if (cnt_shards > kMaxShards) {
+            throw std::invalid_argument("ShardedFixedSet supports up to 64 shards");
+        }
+        shards_.resize(cnt_shards);
+        offsets_.assign(cnt_shards + 1, 0);
+    }
+
+    // Builds every shard on cnt_threads threads of its node, all shards at the same time.
+    // Equal keys and seeds give the same shards on any machine. If a shard fails to build,
+    // the set is left empty and the error is rethrown.
+    void Initialize(const std::vector<Key>& numbers, int cnt_threads = 1) {
+        Initialize(numbers, cnt_threads, Xoshiro256::DrawSeed());
+    }
+
+    void Initialize(const std::vector<Key>& numbers, int cnt_threads, uint64_t seed) {
+        hash_.reset();
+        offsets_.assign(shards_.size() + 1, 0);
+        Generator generator(seed);
+        HashFunction hash = generator.Generate();
+        std::vector<std::vector<Key>> parts(shards_.size());
+        for (const Key& number: numbers) {
+            parts[GetShard(hash, number)].push_back(number);
+        }
+        std::vector<std::thread> builders;
+        std::vector<std::exception_ptr> errors(shards_.size());
+        for (size_t s = 0; s < shards_.size(); ++s) {
+            builders.emplace_back([&, s] {
+                try {
+                    topology_.PinToNode(GetNode(s));
+                    shards_[s].Initialize(parts[s], cnt_threads, SplitMix64(seed + s));
+                    std::vector<Key>().swap(parts[s]);
+                } catch (...) {
+                    errors[s] = std::current_exception();
+                }
+            });
+        }
+        for (std::thread& builder: builders) {
+            builder.join();
+        }
+        for (const std::exception_ptr& error: errors) {
+            if (error) {
+                std::rethrow_exception(error);
+            }
+        }
+        for (size_t s = 0; s < shards_.size(); ++s) {
+            offsets_[s + 1] = offsets_[s] + shards_[s].Size();
+        }
+        hash_ = hash;
+    }
+
+    size_t GetShardCount() const noexcept {
+        return shards_.size();
+    }
+
+    size_t GetShard(const Key& number) const noexcept {
+        return GetShard(*hash_, number);
+    }
+
+    size_t GetNode(size_t shard) const noexcept {
+        return shard % topology_.GetNodeCount();
+    }
+
+    const Set& GetShardSet(size_t shard) const noexcept {
+        return shards_[shard];
+    }
+
+    size_t Size() const noexcept {
+        return offsets_.back();
+    }
+
+    size_t GetMemoryUsage() const noexcept {
+        size_t memory = 0;
+        for (const Set& shard: shards_) {
+            memory += shard.GetMemoryUsage();
+        }
+        return memory;
+    }
+
+    bool Contains(const Key& number) const noexcept {
+        return hash_ && shards_[GetShard(number)].Contains(number);
+    }
+
+    // Dense over the whole set: shard s hands out [offsets_[s], offsets_[s + 1]).
+    std::optional<uint32_t> IndexOf(const Key& number) const noexcept {
+        if (!hash_) {
+            return std::nullopt;
+        }
+        size_t shard = GetShard(number);
+        std::optional<uint32_t> index = shards_[shard].IndexOf(number);
+        if (index) {
+            *index += offsets_[shard];
+        }
+        return index;
+    }
+
+    // Sorts every chunk of keys by shard and answers each shard's keys with one
+    // ContainsBatch of that shard.
+    void ContainsBatch(const Key* keys, size_t n, uint8_t* out) const noexcept {
+        if (!hash_) {
+            std::fill(out, out + n, 0);
+            return;
+        }
+        uint8_t owners[kRouteChunk];
+        uint32_t order[kRouteChunk];
+        Key routed[kRouteChunk];
+        uint8_t answers[kRouteChunk];
+        for (size_t start = 0; start < n; start += kRouteChunk) {
+            size_t count = std::min(kRouteChunk, n - start);
+            uint32_t starts[kMaxShards + 1] = {};
+            for (size_t i = 0; i < count; ++i) {
+                owners[i] = GetShard(keys[start + i]);
+                ++starts[owners[i] + 1];
+            }
+            for (size_t s = 0; s < shards_.size(); ++s) {
+                starts[s + 1] += starts[s];
+            }
+            uint32_t positions[kMaxShards];
+            std::copy(starts, starts + shards_.size(), positions);
+            for (size_t i = 0; i < count; ++i) {
+                uint32_t position = positions[owners[i]]++;
+                order[position] = i;
+                routed[position] = keys[start + i];
+            }
+            for (size_t s = 0; s < shards_.size(); ++s) {
+                shards_[s].ContainsBatch(routed + starts[s], starts[s + 1] - starts[s],
+                                         answers + starts[s]);
+            }
+            for (size_t i = 0; i < count; ++i) {
+                out[start + order[i]] = answers[i];
+            }
+        }
+    }
+};
+
+using ShardedFixedSet = BasicShardedFixedSet<>;
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <thread>
+#include <utility>
+
+// Bounded lock-free queue for exactly one producer thread and one consumer thread. Each
+// side owns one index and only reads the other's, so a push or a pop is a couple of
+// loads and one release store. The indices sit on separate cache lines to keep the two
+// threads from invalidating each other's line on every operation.
+template <class T>
+class SpscRing {
+    static constexpr size_t kCacheLine = 64;
+
+    size_t capacity_;
+    std::unique_ptr<T[]> items_;
+    // Next index to pop, written by the consumer only.
+    alignas(kCacheLine) std::atomic<size_t> head_{0};
+    // Next index to push, written by the producer only.
+    alignas(kCacheLine) std::atomic<size_t> tail_{0};
+
+public:
+    explicit SpscRing(size_t capacity) : capacity_(capacity + 1), items_(new T[capacity + 1]) {
+    }
+
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+
+    bool TryPush(T& item) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        size_t next = tail + 1 == capacity_ ? 0 : tail + 1;
+        if (next == head_.load(std::memory_order_acquire)) {
+            return false;
+        }
+        items_[tail] = std::move(item);
+        tail_.store(next, std::memory_order_release);
+        return true;
+    }
+
+    bool TryPop(T& item) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = std::move(items_[head]);
+        head_.store(head + 1 == capacity_ ? 0 : head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Blocking versions, they yield the processor while the ring is full or empty.
+    void Push(T item) {
+        while (!TryPush(item)) {
+            std::this_thread::yield();
+        }
+    }
+
+    T Pop() {
+        T item;
+        while (!TryPop(item)) {
+            std::this_thread::yield();
+        }
+        return item;
+    }
+};
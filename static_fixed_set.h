@@ -0,0 +1,182 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "fixed_set.h"
+
+// FixedSet of int keys known at compile time. MakeFixedSet runs the FKS build during
+// constant evaluation, so a set declared constexpr costs nothing at startup, its tables
+// are read-only data and lookups of constant keys fold away:
+//
+//     constexpr auto kOpcodes = MakeFixedSet<0x01, 0x0f, 0x3c>();
+//     static_assert(kOpcodes.Contains(0x0f));
+//
+// The layout is the one of BasicFixedSet with the linear policy: N first-level buckets,
+// buckets of up to two keys scanned, larger ones hashed into len^2 slots, free slots
+// filled with a key of another bucket and empty buckets sharing slot 0. The first level is
+// redrawn until the sum of squared bucket sizes is at most 2N, which also bounds the slot
+// table, so everything fits into arrays sized by N. Sets of a few thousand keys build
+// within the default constexpr evaluation limits of GCC and Clang. Duplicate keys, or a
+// build that runs out of attempts, make the evaluation fail to compile.
+template <size_t N>
+class StaticFixedSet {
+    static constexpr int kMaxCountRun = 1000;
+    static constexpr uint32_t kScanSize = 2;
+    static constexpr uint32_t kSharedSlot = 0;
+    static constexpr size_t kCntBuckets = N > 0 ? N : 1;
+    static constexpr size_t kCntSlots = 2 * N + 1;
+
+    struct Bucket {
+        uint32_t offset = kSharedSlot;
+        uint32_t size = 1;
+        LinearHashFunction hash = LinearHashFunction(1, 0, GenerateLinearHashFunction::kPrime);
+    };
+
+    LinearHashFunction hash_ = LinearHashFunction(1, 0, GenerateLinearHashFunction::kPrime);
+    std::array<Bucket, kCntBuckets> buckets_ = {};
+    std::array<int, kCntSlots> slots_ = {};
+    uint64_t seed_ = 0;
+
+    static constexpr uint32_t GetIndex(const LinearHashFunction& hash, int number,
+                                       uint32_t cnt_buckets) noexcept {
+        return LinearHashPolicy::Reduce(hash.GetHash(number), cnt_buckets);
+    }
+
+    constexpr void Build(const std::array<int, N>& keys) {
+        GenerateLinearHashFunction generator(seed_);
+        std::array<uint32_t, kCntBuckets> lens = {};
+        int count_run = 0;
+        for (;; ++count_run) {
+            if (count_run == kMaxCountRun) {
+                throw BadHashFunctionException("Too many attempts");
+            }
+            hash_ = generator.Generate();
+            for (uint32_t& len: lens) {
+                len = 0;
+            }
+            uint64_t square_sum = 0;
+            for (int key: keys) {
+                uint32_t len = ++lens[GetIndex(hash_, key, N)];
+                square_sum += 2 * len - 1;
+            }
+            if (square_sum <= 2 * N) {
+                break;
+            }
+        }
+
+        // Buckets get their tables in index order, starts[i] is where bucket i fills in its
+        // keys while they are distributed.
+        uint32_t total_size = 1;
+        std::array<uint32_t, kCntBuckets> filled = {};
+        for (size_t i = 0; i < N; ++i) {
+            if (lens[i] > 0) {
+                buckets_[i].offset = total_size;
+                buckets_[i].size = lens[i] <= kScanSize ? lens[i] : lens[i] * lens[i];
+                total_size += buckets_[i].size;
+            }
+        }
+        std::array<int, N> grouped = {};
+        std::array<uint32_t, kCntBuckets> starts = {};
+        for (size_t i = 1; i < N; ++i) {
+            starts[i] = starts[i - 1] + lens[i - 1];
+        }
+        for (int key: keys) {
+            uint32_t index = GetIndex(hash_, key, N);
+            grouped[starts[index] + filled[index]++] = key;
+        }
+
+        std::array<bool, kCntSlots> used = {};
+        for (size_t i = 0; i < N; ++i) {
+            Bucket& bucket = buckets_[i];
+            const int* begin = grouped.data() + starts[i];
+            const int* end = begin + lens[i];
+            if (lens[i] == 0) {
+                continue;
+            }
+            if (lens[i] <= kScanSize) {
+                if (lens[i] == kScanSize && begin[0] == begin[1]) {
+                    throw DuplicateKeyException("Duplicate key");
+                }
+                for (uint32_t j = 0; j < lens[i]; ++j) {
+                    slots_[bucket.offset + j] = begin[j];
+                    used[bucket.offset + j] = true;
+                }
+                continue;
+            }
+            for (int attempt = 0;; ++attempt) {
+                if (attempt == kMaxCountRun) {
+                    throw BadHashFunctionException("Too many attempts");
+                }
+                bucket.hash = generator.Generate();
+                bool collision = false;
+                for (const int* it = begin; it != end && !collision; ++it) {
+                    uint32_t index = bucket.offset + GetIndex(bucket.hash, *it, bucket.size);
+                    if (used[index] && slots_[index] == *it) {
+                        throw DuplicateKeyException("Duplicate key");
+                    }
+                    collision = used[index];
+                    slots_[index] = *it;
+                    used[index] = true;
+                }
+                if (!collision) {
+                    break;
+                }
+                for (uint32_t j = 0; j < bucket.size; ++j) {
+                    used[bucket.offset + j] = false;
+                }
+            }
+        }
+        for (size_t j = 0; j < kCntSlots; ++j) {
+            if (!used[j]) {
+                slots_[j] = keys[0];
+            }
+        }
+    }
+
+public:
+    static constexpr uint64_t kDefaultSeed = 0x5eed;
+
+    constexpr explicit StaticFixedSet(const std::array<int, N>& keys,
+                                      uint64_t seed = kDefaultSeed) : seed_(seed) {
+        if (N > 0) {
+            Build(keys);
+        }
+    }
+
+    constexpr bool Contains(int number) const noexcept {
+        if (N == 0) {
+            return false;
+        }
+        const Bucket& bucket = buckets_[GetIndex(hash_, number, N)];
+        if (bucket.size <= kScanSize) {
+            return slots_[bucket.offset] == number ||
+                   (bucket.size == kScanSize && slots_[bucket.offset + 1] == number);
+        }
+        return slots_[bucket.offset + GetIndex(bucket.hash, number, bucket.size)] == number;
+    }
+
+    static constexpr size_t Size() noexcept {
+        return N;
+    }
+
+    constexpr uint64_t GetSeed() const noexcept {
+        return seed_;
+    }
+
+    static constexpr size_t GetMemoryUsage() noexcept {
+        return sizeof(StaticFixedSet);
+    }
+};
+
+template <size_t N>
+constexpr StaticFixedSet<N> MakeFixedSet(const std::array<int, N>& keys,
+                                         uint64_t seed = StaticFixedSet<N>::kDefaultSeed) {
+    return StaticFixedSet<N>(keys, seed);
+}
+
+template <int... Keys>
+constexpr StaticFixedSet<sizeof...(Keys)> MakeFixedSet() {
+    return StaticFixedSet<sizeof...(Keys)>(std::array<int, sizeof...(Keys)>{Keys...});
+}